@@ -0,0 +1,93 @@
+
+// Compares the per-hit TH1D / TH2D fill path (variable bin edges, acos per hit) with the batched
+// SpeciesHistograms::Fill kernel, on the default binning of the energy, zenith and depth histograms
+
+#include "Binning.h"
+#include "SpeciesHistograms.h"
+
+#include <TH1D.h>
+#include <TH2D.h>
+#include <TMath.h>
+
+#include <chrono>
+#include <iostream>
+#include <random>
+#include <vector>
+
+using namespace std;
+
+int main(int argc, char **argv) {
+    const size_t nHits = argc > 1 ? stoul(argv[1]) : 10000000;
+    const size_t batchSize = argc > 2 ? stoul(argv[2]) : 256;
+
+    TH1::AddDirectory(false);
+
+    mt19937_64 generator(42);
+    exponential_distribution<double> energyDistribution(0.5);
+    uniform_real_distribution<double> cosZenithDistribution(0, 1);
+    uniform_real_distribution<double> depthDistribution(0, 1000);
+
+    vector<double> energy(nHits), cosZenith(nHits), depth(nHits), weight(nHits, 1.0);
+    for (size_t i = 0; i < nHits; ++i) {
+        energy[i] = energyDistribution(generator);
+        cosZenith[i] = cosZenithDistribution(generator);
+        depth[i] = depthDistribution(generator);
+    }
+
+    const Binning binning(Axis(Axis::Scale::Linear, 1000, 0, 10),
+                          Axis(Axis::Scale::Linear, 100, 0, 90),
+                          Axis(Axis::Scale::Linear, 500, 0, 1000));
+
+    double binsEnergy[1001];
+    for (int i = 0; i <= 1000; ++i) {
+        binsEnergy[i] = i * 10.0 / 1000;
+    }
+    TH1D energyHistogram("energy", "", 1000, binsEnergy);
+    TH1D zenithHistogram("zenith", "", 100, 0, 90);
+    TH2D energyZenithHistogram("energy_zenith", "", 1000, binsEnergy, 100, 0, 90);
+    TH1D depthHistogram("depth", "", 500, 0, 1000);
+
+    auto start = chrono::steady_clock::now();
+    for (size_t i = 0; i < nHits; ++i) {
+        const double zenith = TMath::ACos(cosZenith[i]) * TMath::RadToDeg();
+        energyHistogram.Fill(energy[i]);
+        zenithHistogram.Fill(zenith);
+        energyZenithHistogram.Fill(energy[i], zenith);
+        depthHistogram.Fill(depth[i]);
+    }
+    const auto perHit = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+    SpeciesHistograms histograms(binning);
+    start = chrono::steady_clock::now();
+    for (size_t i = 0; i < nHits; i += batchSize) {
+        const auto size = min(batchSize, nHits - i);
+        histograms.Fill(&energy[i], &cosZenith[i], &depth[i], &weight[i], size);
+    }
+    const auto batched = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+    const auto [energyBatched, zenithBatched, energyZenithBatched, depthBatched] =
+            histograms.CreateROOTHistograms("batched", "Batched");
+
+    // both paths must agree bin by bin
+    size_t mismatches = 0;
+    for (int bin = 0; bin < energyHistogram.GetNcells(); ++bin) {
+        mismatches += energyHistogram.GetBinContent(bin) != energyBatched->GetBinContent(bin);
+    }
+    for (int bin = 0; bin < zenithHistogram.GetNcells(); ++bin) {
+        mismatches += zenithHistogram.GetBinContent(bin) != zenithBatched->GetBinContent(bin);
+    }
+    for (int bin = 0; bin < energyZenithHistogram.GetNcells(); ++bin) {
+        mismatches += energyZenithHistogram.GetBinContent(bin) != energyZenithBatched->GetBinContent(bin);
+    }
+    for (int bin = 0; bin < depthHistogram.GetNcells(); ++bin) {
+        mismatches += depthHistogram.GetBinContent(bin) != depthBatched->GetBinContent(bin);
+    }
+
+    cout << "Hits: " << nHits << ", batch size: " << batchSize << endl;
+    cout << "TH1D / TH2D Fill: " << 1E9 * perHit / nHits << " ns / hit" << endl;
+    cout << "Batched fill: " << 1E9 * batched / nHits << " ns / hit" << endl;
+    cout << "Speedup: " << perHit / batched << endl;
+    cout << "Mismatched bins: " << mismatches << endl;
+
+    return mismatches == 0 ? 0 : 1;
+}
@@ -1,17 +1,43 @@
 #include <G4RunManager.hh>
+#include <G4GeometrySampler.hh>
+#include <G4ImportanceBiasing.hh>
+#include <G4MTRunManager.hh>
 #include <G4RunManagerFactory.hh>
+#include <Randomize.hh>
+#include <G4StepLimiterPhysics.hh>
+#include <G4SystemOfUnits.hh>
 
+#include "Checkpoint.h"
+#include "Convergence.h"
+#include "Culling.h"
+#include "DepthSampler.h"
 #include "DetectorConstruction.h"
+#include "EventSeeding.h"
+#include "MPIRun.h"
+#include "PhaseSpace.h"
+#include "PhysicsCache.h"
 #include "PhysicsList.h"
+#include "PrimarySource.h"
 #include "ActionInitialization.h"
 #include "RunAction.h"
+#include "SecondaryWriter.h"
+#include "ShardMerger.h"
+#include "Spectrum.h"
+#include "StartupProfile.h"
+#include "SpeciesRegistry.h"
+#include "ThreadAffinity.h"
 
 #include "CLI/CLI.hpp"
 
+#include <TROOT.h>
+
 #include <chrono>
 #include <iostream>
 #include <thread>
 #include <filesystem>
+#include <functional>
+#include <map>
+#include <sstream>
 
 using namespace std;
 
@@ -20,11 +46,16 @@ void printProgress() {
     // lambda to check if the condition has been met (RunAction::GetLaunchedPrimaries() < RunAction::GetRequestedPrimaries()) or (RunAction::GetSecondariesCount() < RunAction::GetRequestedSecondaries())
 
     auto checkCondition = []() {
+        if (Convergence::IsConverged()) {
+            return false;
+        }
         if (RunAction::GetRequestedPrimaries() > 0) {
             return RunAction::GetLaunchedPrimaries() < RunAction::GetRequestedPrimaries();
-        } else {
+        } else if (RunAction::GetRequestedSecondaries() > 0) {
             return RunAction::GetSecondariesCount() < RunAction::GetRequestedSecondaries();
         }
+        // only the convergence targets stop the run
+        return true;
     };
 
     cout << "Requested primaries: " << RunAction::GetRequestedPrimaries() << endl;
@@ -37,27 +68,96 @@ void printProgress() {
             cout << "Progress (primaries): " << count << " / " << RunAction::GetRequestedPrimaries()
                  << " (" << 100.0 * double(count) / RunAction::GetRequestedPrimaries() << "%)"
                  << " Elapsed time: " << elapsed << " s" << endl;
-        } else {
+        } else if (RunAction::GetRequestedSecondaries() > 0) {
             const auto count = RunAction::GetSecondariesCount();
             cout << "Progress (secondaries): " << count << " / " << RunAction::GetRequestedSecondaries()
                  << " (" << 100.0 * double(count) / RunAction::GetRequestedSecondaries() << "%)"
                  << " Elapsed time: " << elapsed << " s" << endl;
+        } else {
+            cout << "Progress (primaries): " << RunAction::GetLaunchedPrimaries() << " Elapsed time: " << elapsed
+                 << " s" << endl;
+        }
+        if (Convergence::IsEnabled()) {
+            cout << Convergence::GetProgress() << endl;
         }
 
         std::this_thread::sleep_for(std::chrono::seconds(1));
     } while (checkCondition());
 }
 
+// "merge" command: sums shard files and normalizes them
+int mergeShards(int argc, char **argv) {
+    vector<string> inputFilenames;
+    string outputFilename;
+
+    CLI::App app{"radiation-transmission merge"};
+
+    app.add_option("shards", inputFilenames, "Shard files written with --shard")->required()->check(
+            CLI::ExistingFile);
+    app.add_option("-o,--output", outputFilename, "Output root filename")->required();
+
+    CLI11_PARSE(app, argc, argv)
+
+    ShardMerger::Merge(inputFilenames, outputFilename);
+
+    return 0;
+}
+
 int main(int argc, char **argv) {
+    if (argc > 1 && string(argv[1]) == "merge") {
+        return mergeShards(argc - 1, argv + 1);
+    }
+
+    // does nothing unless built with MPI
+    MPIRun::Initialize(&argc, &argv);
+
     const auto timeStart = chrono::steady_clock::now();
+    StartupProfile::Start("options");
 
     int nEvents = 0;
     int nSecondariesLimit = 0;
     int nThreads = 0;
+    uint64_t seed = 0;
+    string shard;
+    int mpiBlockSize = 1000;
+    string runManagerName;
+    int eventsPerTask = 0;
+    string pinThreads = "none";
+    vector<string> convergenceTargets;
+    int convergenceBatchSize = 1000;
+    string checkpointFilename;
+    double checkpointInterval = 600;
+    string resumeFilename;
 
     string outputFilename;
-    string inputParticleName;
+    vector<string> inputParticles;
+    string inputFilename;
+    string inputHistogramName;
     vector<pair<string, double>> detectorConfiguration;
+    vector<string> scoredSpecies = SpeciesRegistry::GetDefaultSpecies();
+    vector<string> binning;
+    double depthBiasLength = 0;
+    string depthBiasFilename;
+    string physicsPreset = "full";
+    double meanLifeThreshold = 1;
+    double veryLongDecayTime = 1e12;
+    string physicsCacheDirectory;
+    bool fastInit = false;
+    string startupProfileFilename;
+    double slabThickness = 0;
+    double importanceRatio = 0;
+    vector<string> importanceParticles = {"gamma", "neutron"};
+    double productionCut = 1;
+    double farProductionCut = 0;
+    double farMinKineticEnergy = 0;
+    double rangeCullingMaxEnergy = 0;
+    bool upstreamCulling = false;
+    string treeFilename;
+    string phaseSpaceOutputFilename;
+    string phaseSpaceInputFilename;
+    int treeCompression = 101;
+    int treeBasketSize = 32000;
+    long long treeAutoFlush = -30000000;
 
     CLI::App app{"radiation-transmission"};
 
@@ -67,52 +167,382 @@ int main(int argc, char **argv) {
             CLI::PositiveNumber);
     app.add_option("-t,--threads", nThreads, "Number of threads. t=0 means no multithreading (default)")->check(
             CLI::NonNegativeNumber);
-    app.add_option("-p,--particle", inputParticleName, "Input particle name")->required();
+    app.add_option("--run-manager", runManagerName,
+                   "Run manager: 'serial', 'mt' (a fixed pool of threads given events in batches) or 'tasking' (events run as tasks of a thread pool). By default serial without -t and mt with it")->check(
+            CLI::IsMember({"serial", "mt", "tasking"}));
+    app.add_option("--events-per-task", eventsPerTask,
+                   "Events given at once to a thread by the mt and tasking run managers, by default the square root of the number of events. Smaller batches balance the end of the run better")->check(
+            CLI::PositiveNumber);
+    app.add_option("--pin-threads", pinThreads,
+                   "Pin each worker to a CPU: 'compact' fills a socket before the next one, 'scatter' alternates sockets. Physical cores are used before their SMT siblings")->check(
+            CLI::IsMember(ThreadAffinity::GetPolicyNames()))->capture_default_str();
+    app.add_option("--convergence", convergenceTargets,
+                   "Stop once the flux of a species, or of an energy window of it (MeV), has this relative uncertainty, e.g. 'neutron=0.05' or 'gamma:0.01:0.1=0.02'. Every target must be met, -n or -s then only cap the run")->delimiter(
+            ',');
+    app.add_option("--convergence-batch", convergenceBatchSize,
+                   "Events per batch of the batch means estimating the uncertainty of the convergence targets")->check(
+            CLI::PositiveNumber)->capture_default_str();
+    app.add_option("--checkpoint", checkpointFilename,
+                   "Periodically write the unnormalized histograms, counters and random engine states to this root file, which the merge command turns into a normalized snapshot");
+    app.add_option("--checkpoint-interval", checkpointInterval, "Seconds between checkpoints")->check(
+            CLI::PositiveNumber)->capture_default_str();
+    app.add_option("--resume", resumeFilename,
+                   "Continue the run of this checkpoint, with the same options, until its -n, -s or convergence targets are met")->check(
+            CLI::ExistingFile);
+    auto seedOption = app.add_option("--seed", seed,
+                   "Seed every event from this seed and its index, so the results do not depend on the number of threads");
+    app.add_option("--shard", shard,
+                   "Run only the slice INDEX/COUNT (INDEX from 0) of the -n events and write unnormalized histograms, to be combined by the merge command")->excludes(
+            "--secondaries");
+#ifdef WITH_MPI
+    app.add_option("--mpi-block-size", mpiBlockSize,
+                   "Events handed out at once to each MPI rank")->check(CLI::PositiveNumber)->capture_default_str();
+#endif
+    app.add_option("-p,--particle", inputParticles,
+                   "Input particle name (e.g. 'Cs137', 'Am241[59.541]' or 'gamma'), or comma separated isotopes decaying together with their activities (e.g. 'Cs137:1000,Am241:50')")->delimiter(',');
+    auto inputOption = app.add_option("-i,--input", inputFilename,
+                   "Input root filename with the energy (TH1, MeV) or energy vs zenith angle (TH2, MeV and degrees) spectrum of the primaries, which are then launched from the upstream face of the stack");
+    app.add_option("--input-histogram", inputHistogramName,
+                   "Name of the input spectrum histogram, by default the first histogram in the input file")->needs(inputOption);
+    auto depthBiasLengthOption = app.add_option("--depth-bias-length", depthBiasLength,
+                   "Sample the decay depth with a density exp(-depth / LENGTH) towards the detector (LENGTH in mm) instead of uniformly, each decay is weighted to keep the histograms unbiased")->check(
+            CLI::PositiveNumber)->excludes(inputOption);
+    app.add_option("--depth-bias-pdf", depthBiasFilename,
+                   "Sample the decay depth from the bin contents of the first TH1 (depth in mm) in this root file instead of uniformly, each decay is weighted to keep the histograms unbiased")->excludes(
+            inputOption)->excludes(depthBiasLengthOption);
     app.add_option("-o,--output", outputFilename, "Output root filename")->required();
     app.add_option("-d,--detector", detectorConfiguration,
                    "Detector configuration: material and thickness (in mm) in the following format: '-d G4_Pb 100'. If called multiple times they will be stacked")->required();
+    app.add_option("--physics", physicsPreset,
+                   "Physics preset: 'full' (option4 EM, QGSP_BIC_HP hadrons with HP neutrons), 'standard' (option4 EM, QGSP_BIC hadrons without neutron data) or 'fast' (standard EM and decays only, for gamma and beta emitters)")->check(
+            CLI::IsMember(PhysicsList::GetPresets()))->capture_default_str();
+    app.add_option("--mean-life-threshold", meanLifeThreshold,
+                   "Nuclides with a shorter mean life (in years) decay as part of the chain of the primary")->check(
+            CLI::PositiveNumber)->capture_default_str();
+    app.add_option("--very-long-decay-time", veryLongDecayTime,
+                   "Decays slower than this (in years) are not simulated")->check(
+            CLI::PositiveNumber)->capture_default_str();
+    app.add_option("--physics-cache", physicsCacheDirectory,
+                   "Directory where the physics tables are stored after being built, and retrieved from by later runs with the same physics preset, production cuts and materials");
+    app.add_option("--slab-thickness", slabThickness,
+                   "Split the layers in slabs no thicker than this (in mm)")->check(CLI::PositiveNumber);
+    app.add_option("--importance-ratio", importanceRatio,
+                   "Importance biasing: the importance of each slab is this times the one upstream of it, tracks are split or killed by Russian roulette when crossing slabs")->check(
+            CLI::PositiveNumber);
+    app.add_option("--importance-particles", importanceParticles,
+                   "Particles subject to the importance biasing, as comma separated names")->delimiter(
+            ',')->capture_default_str();
+    app.add_option("--production-cut", productionCut,
+                   "Production cut (in mm) of the secondaries next to the detector")->check(
+            CLI::PositiveNumber)->capture_default_str();
+    app.add_option("--far-production-cut", farProductionCut,
+                   "Production cut (in mm) at the upstream face of the stack. Each slab gets its own region with a cut growing geometrically with its distance to the detector")->check(
+            CLI::PositiveNumber);
+    app.add_option("--far-min-energy", farMinKineticEnergy,
+                   "Kill charged tracks below this kinetic energy (in MeV) at the upstream face of the stack, the threshold of each slab goes down linearly with its distance to reach 0 at the detector. Neutral particles are not affected")->check(
+            CLI::PositiveNumber);
+    app.add_option("--range-culling", rangeCullingMaxEnergy,
+                   "Kill charged tracks below this kinetic energy (in MeV) whose range is shorter than their distance to the detector")->check(
+            CLI::PositiveNumber);
+    app.add_flag("--upstream-culling", upstreamCulling,
+                 "Kill tracks leaving the stack through its upstream face, they can not come back to the detector");
+    app.add_option("--species", scoredSpecies,
+                   "Scored secondary species, as comma separated particle names (e.g. 'e-,gamma,proton,mu-'). 'ion' scores every generic ion")->delimiter(',')->capture_default_str();
+    app.add_option("--binning", binning,
+                   "Histogram binning as '[SPECIES/]AXIS=SCALE:N:MIN:MAX' with AXIS energy (MeV), zenith (degrees) or depth (mm) and SCALE lin or log, e.g. '--binning energy=log:5000:1e-4:100 --binning neutron/energy=log:2000:1e-9:20'");
+    app.add_option("--tree", treeFilename,
+                   "Also write every scored secondary (species, energy, direction, depth, weight, event id and creator process) to a TTree in this root file");
+    app.add_option("--tree-compression", treeCompression,
+                   "Compression setting of the tree file as algorithm * 100 + level, e.g. 505 for ZSTD level 5")->check(
+            CLI::NonNegativeNumber)->capture_default_str();
+    app.add_option("--tree-basket-size", treeBasketSize, "Basket size of the tree branches in bytes")->check(
+            CLI::PositiveNumber)->capture_default_str();
+    app.add_option("--tree-auto-flush", treeAutoFlush,
+                   "Cluster size of the tree: entries if positive, bytes if negative")->capture_default_str();
+    app.add_option("--phase-space-output", phaseSpaceOutputFilename,
+                   "Write every particle reaching the detector (species, energy, position, direction and weight) to this binary phase-space file");
+    app.add_option("--phase-space-input", phaseSpaceInputFilename,
+                   "Launch the primaries from a phase-space file instead of decays, one record per event from the upstream face of the stack. Without -n or -s every record is replayed")->excludes("--particle")->excludes(inputOption)->excludes(
+            "--depth-bias-length")->excludes("--depth-bias-pdf");
+    app.add_flag("--fast-init", fastInit,
+                 "Faster startup for short jobs: no material dumps, custom materials parsed only when used and an analytic overlap check of the stack");
+    app.add_option("--startup-profile", startupProfileFilename,
+                   "Write the duration of each startup phase (in ms) to this JSON file, they are always printed");
+    app.set_config("--config", "", "Read the options from a TOML or INI configuration file (e.g. binning = [\"energy=log:5000:1e-4:100\"])");
 
     // primaries or secondaries must be defined, but not both
 
-    CLI11_PARSE(app, argc, argv)
+    try {
+        app.parse(argc, argv);
+    } catch (const CLI::ParseError &e) {
+        // also --help, MPI was initialized before the options could be parsed
+        MPIRun::Finalize();
+        return app.exit(e);
+    }
 
-    if ((nEvents == 0 && nSecondariesLimit == 0) || (nEvents > 0 && nSecondariesLimit > 0)) {
+    if (!phaseSpaceInputFilename.empty()) {
+        PhaseSpaceReader::Open(phaseSpaceInputFilename);
+        if (nEvents == 0 && nSecondariesLimit == 0) {
+            nEvents = (int) min<uint64_t>(PhaseSpaceReader::GetNumberOfRecords(), numeric_limits<int>::max());
+        }
+    } else if (inputParticles.empty()) {
+        throw runtime_error("An input particle or a phase-space input file must be given");
+    }
+
+    Convergence::SetTargets(convergenceTargets);
+    Convergence::SetBatchSize(convergenceBatchSize);
+
+    if (nEvents > 0 && nSecondariesLimit > 0) {
         throw runtime_error("Either primaries or secondaries must be defined, but not both");
     }
+    if (nEvents == 0 && nSecondariesLimit == 0 && !Convergence::IsEnabled()) {
+        throw runtime_error("Either primaries, secondaries or convergence targets must be defined");
+    }
+    if ((!checkpointFilename.empty() || !resumeFilename.empty()) && (!shard.empty() || MPIRun::IsEnabled())) {
+        // a shard is short anyway, and MPI ranks do not share a state which could be written
+        throw runtime_error("Checkpoints can not be used with shards or MPI");
+    }
+    if (!resumeFilename.empty() && (!phaseSpaceInputFilename.empty() || !phaseSpaceOutputFilename.empty())) {
+        // records are read by event index and a phase-space output would only hold the resumed part
+        throw runtime_error("A run reading or writing a phase-space can not be resumed");
+    }
+    if (!checkpointFilename.empty()) {
+        // checkpoints are written by whichever thread completes them
+        ROOT::EnableThreadSafety();
+        Checkpoint::SetFilename(checkpointFilename);
+        Checkpoint::SetInterval(checkpointInterval);
+    }
+    if (!resumeFilename.empty()) {
+        Checkpoint::Resume(resumeFilename);
+        if (nEvents > 0 && Checkpoint::GetResumedTotals().launchedPrimaries >= (unsigned long long) nEvents) {
+            throw runtime_error("The checkpoint already has the requested primaries");
+        }
+        // the events of this run come after every event of the checkpoint
+        EventSeeding::SetEventOffset(Checkpoint::GetResumedEventIndex());
+    }
+    if (Convergence::IsEnabled() && (!shard.empty() || MPIRun::IsEnabled())) {
+        // each process would stop on its own estimate
+        throw runtime_error("Convergence targets can not be used with shards or MPI");
+    }
+
+    if (!shard.empty()) {
+        int shardIndex, shardCount;
+        char end;
+        if (sscanf(shard.c_str(), "%d/%d%c", &shardIndex, &shardCount, &end) != 2 || shardIndex < 0 ||
+            shardIndex >= shardCount) {
+            throw runtime_error("Invalid shard '" + shard + "', expected 'INDEX/COUNT' with 0 <= INDEX < COUNT");
+        }
+        if (shardCount > nEvents) {
+            throw runtime_error("More shards than primaries");
+        }
+        // contiguous slices of the event indices, which also select the seeds and the phase-space records
+        const auto first = (long long) nEvents * shardIndex / shardCount;
+        const auto last = (long long) nEvents * (shardIndex + 1) / shardCount;
+        // shards are always seeded per event, with seed 0 unless given
+        EventSeeding::SetSeed(seed);
+        EventSeeding::SetEventOffset(first);
+        nEvents = (int) (last - first);
+        RunAction::SetShard(shardIndex, shardCount);
+        cout << "Shard " << shardIndex << " of " << shardCount << ": events " << first << " to " << last - 1 << endl;
+    }
+
+    // files written by every rank get the rank in their name
+    auto rankFilename = [](const string &filename) {
+        if (MPIRun::GetRank() == 0) {
+            return filename;
+        }
+        const auto path = filesystem::path(filename);
+        return (path.parent_path() / (path.stem().string() + ".rank" + to_string(MPIRun::GetRank()) +
+                                      path.extension().string())).string();
+    };
 
-    RunAction::SetInputParticle(inputParticleName);
+    if (MPIRun::IsEnabled()) {
+        if (!shard.empty()) {
+            throw runtime_error("Shards can not be combined with MPI, the ranks already split the events");
+        }
+        // events run on any rank, they are always seeded from their index
+        EventSeeding::SetSeed(seed);
+        MPIRun::SetBlockSize(mpiBlockSize);
+        MPIRun::SetTotalEvents(nEvents);
+        cout << "MPI rank " << MPIRun::GetRank() << " of " << MPIRun::GetSize() << endl;
+    }
+
+    if (runManagerName.empty()) {
+        runManagerName = nThreads > 0 ? "mt" : "serial";
+    }
+    if ((runManagerName == "serial") != (nThreads == 0)) {
+        throw runtime_error("The serial run manager runs without threads, the mt and tasking ones need -t");
+    }
+    if (runManagerName == "tasking" && (nEvents == 0 || MPIRun::IsEnabled())) {
+        // every task is created at the start of the run, which needs a fixed number of events
+        throw runtime_error("The tasking run manager needs -n, and can not be used with MPI");
+    }
+
+    ThreadAffinity::SetPolicy(pinThreads);
+    if (ThreadAffinity::IsEnabled() && nThreads == 0) {
+        throw runtime_error("--pin-threads pins the workers, it needs -t");
+    }
+
+    SpeciesRegistry::SetScoredSpecies(scoredSpecies);
+    RunAction::SetBinning(binning);
+
+    if (!treeFilename.empty()) {
+        // the tree is filled and written by a background thread
+        ROOT::EnableThreadSafety();
+        SecondaryWriter::SetOutputFilename(rankFilename(treeFilename));
+        SecondaryWriter::SetCompression(treeCompression);
+        SecondaryWriter::SetBasketSize(treeBasketSize);
+        SecondaryWriter::SetAutoFlush(treeAutoFlush);
+    }
+
+    if (!inputFilename.empty()) {
+        Spectrum::Load(inputFilename, inputHistogramName);
+    }
+
+    if (depthBiasLength > 0) {
+        DepthSampler::SetExponential(depthBiasLength);
+    } else if (!depthBiasFilename.empty()) {
+        DepthSampler::LoadPDF(depthBiasFilename);
+    }
+
+    if (!phaseSpaceOutputFilename.empty()) {
+        PhaseSpaceWriter::SetOutputFilename(rankFilename(phaseSpaceOutputFilename));
+    }
+
+    PrimarySource::SetParticles(inputParticles);
     RunAction::SetOutputFilename(outputFilename);
 
     RunAction::SetRequestedPrimaries(nEvents);
     RunAction::SetRequestedSecondaries(nSecondariesLimit);
+    RunAction::SetNumberOfThreads(nThreads);
+
+    if (*seedOption) {
+        EventSeeding::SetSeed(seed);
+        G4Random::setTheSeed((long) (seed & 0x7FFFFFFF));
+    }
+
+    if (Checkpoint::IsResumed() && !EventSeeding::IsEnabled() && !Checkpoint::GetResumedEngineStates().empty()) {
+        const auto &states = Checkpoint::GetResumedEngineStates();
+        if (nThreads == 0) {
+            // the only engine continues where the checkpoint left it
+            istringstream state(states.front());
+            G4Random::getTheEngine()->get(state);
+        } else {
+            // workers are reseeded for every event from the master engine, which is seeded away from the
+            // seeds of the checkpointed run
+            string joined;
+            for (const auto &state: states) {
+                joined += state;
+            }
+            const uint64_t value = hash<string>{}(joined);
+            const long seeds[3] = {(long) (value >> 33) + 1, (long) ((value >> 2) & 0x7FFFFFFF) + 1, 0};
+            G4Random::setTheSeeds(seeds, -1);
+        }
+    }
+
+    if (!startupProfileFilename.empty()) {
+        StartupProfile::SetOutputFilename(rankFilename(startupProfileFilename));
+    }
+
+    DetectorConstruction::SetFastInit(fastInit);
+    DetectorConstruction::SetSlabThickness(slabThickness);
+    DetectorConstruction::SetProductionCuts(productionCut, farProductionCut);
+    DetectorConstruction::SetFarMinKineticEnergy(farMinKineticEnergy);
+    DetectorConstruction::SetImportanceRatio(importanceRatio);
+
+    Culling::SetRangeCullingMaxEnergy(rangeCullingMaxEnergy);
+    Culling::SetUpstreamCulling(upstreamCulling);
 
-    const auto runManagerType = nThreads > 0 ? G4RunManagerType::MTOnly : G4RunManagerType::SerialOnly;
-    auto runManager = unique_ptr<G4RunManager>(G4RunManagerFactory::CreateRunManager(runManagerType));
+    // must outlive the run manager
+    vector<unique_ptr<G4GeometrySampler>> importanceSamplers;
+
+    StartupProfile::Stop("options");
+    StartupProfile::Start("setup");
+
+    const map<string, G4RunManagerType> runManagerTypes = {{"serial", G4RunManagerType::SerialOnly},
+                                                           {"mt",       G4RunManagerType::MTOnly},
+                                                           {"tasking",  G4RunManagerType::TaskingOnly}};
+    auto runManager = unique_ptr<G4RunManager>(
+            G4RunManagerFactory::CreateRunManager(runManagerTypes.at(runManagerName)));
 
     if (nThreads > 0) {
         runManager->SetNumberOfThreads((G4int) nThreads);
+        // the tasking run manager derives from the mt one, events per task are its event modulo
+        if (eventsPerTask > 0) {
+            dynamic_cast<G4MTRunManager *>(runManager.get())->SetEventModulo(eventsPerTask);
+        }
+        if (ThreadAffinity::IsEnabled()) {
+            ThreadAffinity::Initialize(nThreads);
+            runManager->SetUserInitialization(new WorkerInitialization);
+        }
+    }
+
+    auto detectorConstruction = new DetectorConstruction(detectorConfiguration);
+    runManager->SetUserInitialization(detectorConstruction);
+
+    if (!physicsCacheDirectory.empty()) {
+        PhysicsCache::SetDirectory(physicsCacheDirectory);
     }
 
-    runManager->SetUserInitialization(new DetectorConstruction(detectorConfiguration));
-    runManager->SetUserInitialization(new PhysicsList);
+    PhysicsList::SetMeanLifeThreshold(meanLifeThreshold);
+    PhysicsList::SetVeryLongDecayTime(veryLongDecayTime);
+    auto physicsList = new PhysicsList(physicsPreset);
+    physicsList->SetDefaultCutValue(productionCut * CLHEP::mm);
+    if (DetectorConstruction::HasUserLimits()) {
+        // provides the process killing the tracks below the minimum kinetic energy of their region, only applied to
+        // charged particles: neutral ones travel far enough to reach the detector from any slab
+        physicsList->RegisterPhysics(new G4StepLimiterPhysics());
+    }
+    if (importanceRatio > 0) {
+        // the samplers need the world, Initialize then skips the geometry
+        runManager->InitializeGeometry();
+        for (const auto &particle: importanceParticles) {
+            importanceSamplers.push_back(make_unique<G4GeometrySampler>(detectorConstruction->GetWorld(), particle));
+            physicsList->RegisterPhysics(new G4ImportanceBiasing(importanceSamplers.back().get()));
+        }
+    }
+    runManager->SetUserInitialization(physicsList);
 
     runManager->SetUserInitialization(new ActionInitialization);
 
+    StartupProfile::Stop("setup");
+
+    StartupProfile::Start("initialize");
     runManager->Initialize();
+    StartupProfile::Stop("initialize");
+
+    if (PhysicsCache::IsEnabled()) {
+        StartupProfile::Start("physics cache");
+        PhysicsCache::Retrieve(physicsList, physicsPreset);
+        if (!PhysicsCache::IsRetrieved()) {
+            // a run without events builds the tables, without calling the user run actions
+            runManager->BeamOn(0);
+            PhysicsCache::Store(physicsList);
+        }
+        StartupProfile::Stop("physics cache");
+    }
 
     std::thread t(printProgress);
     t.detach();
 
     cout << "nEvents: " << nEvents << endl;
-    if (nEvents > 0) {
-        runManager->BeamOn(nEvents);
+    // stopped by the master run action, the physics tables are built in between unless retrieved
+    StartupProfile::Start("run initialization");
+    // with MPI the run ends once rank 0 has no blocks left
+    if (nEvents > 0 && !MPIRun::IsEnabled()) {
+        // -n counts the primaries of the checkpoint this run resumes
+        runManager->BeamOn(nEvents - (int) Checkpoint::GetResumedTotals().launchedPrimaries);
     } else {
         runManager->BeamOn(numeric_limits<int>::max());
     }
 
-    const auto elapsed = chrono::duration_cast<chrono::seconds>(chrono::steady_clock::now() - timeStart).count();
+    StartupProfile::Report();
+
+    const auto elapsed = chrono::duration<double>(chrono::steady_clock::now() - timeStart).count();
 
     cout << "Total runtime: " << elapsed << " s" << endl;
 
+    MPIRun::Finalize();
+
     return 0;
 }
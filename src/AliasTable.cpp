@@ -0,0 +1,41 @@
+
+#include "AliasTable.h"
+
+#include <stdexcept>
+
+using namespace std;
+
+AliasTable::AliasTable(const vector<double> &weights) : n((int) weights.size()), probability(n, 1.0), alias(n) {
+    for (const auto weight: weights) {
+        if (!(weight >= 0)) {
+            throw runtime_error("Alias table weights must not be negative");
+        }
+        total += weight;
+    }
+    if (!(total > 0)) {
+        throw runtime_error("Alias table weights must not all be zero");
+    }
+
+    // Vose's method: pair each under-full column with an over-full one which fills the rest of it
+    vector<double> scaled(n);
+    vector<int> small, large;
+    for (int i = 0; i < n; ++i) {
+        scaled[i] = weights[i] * n / total;
+        alias[i] = i;
+        (scaled[i] < 1.0 ? small : large).push_back(i);
+    }
+    while (!small.empty() && !large.empty()) {
+        const auto s = small.back();
+        small.pop_back();
+        const auto l = large.back();
+
+        probability[s] = scaled[s];
+        alias[s] = l;
+        scaled[l] += scaled[s] - 1.0;
+        if (scaled[l] < 1.0) {
+            large.pop_back();
+            small.push_back(l);
+        }
+    }
+    // whatever is left is full up to rounding errors and keeps probability 1
+}
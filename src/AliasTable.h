@@ -0,0 +1,32 @@
+
+#pragma once
+
+#include <vector>
+
+// Walker alias table: samples an index with probability proportional to its weight in constant time,
+// whatever the number of weights. Read only once built, so it can be shared between threads
+class AliasTable {
+public:
+    AliasTable() = default;
+
+    explicit AliasTable(const std::vector<double>& weights);
+
+    // u uniform in [0, 1)
+    int Sample(double u) const {
+        const double x = u * n;
+        int i = (int) x;
+        i = i < n ? i : n - 1;
+        return x - i < probability[i] ? i : alias[i];
+    }
+
+    int GetSize() const { return n; }
+
+    double GetTotal() const { return total; }
+
+private:
+    int n = 0;
+    double total = 0;
+
+    std::vector<double> probability;
+    std::vector<int> alias;
+};
@@ -0,0 +1,122 @@
+
+#include "Binning.h"
+
+#include <algorithm>
+#include <sstream>
+#include <stdexcept>
+
+using namespace std;
+
+Axis::Axis(Scale scale, int n, double min, double max) : scale(scale), n(n), min(min), max(max) {
+    if (n <= 0) {
+        throw runtime_error("Number of bins must be positive");
+    }
+    if (max <= min) {
+        throw runtime_error("Axis maximum must be larger than its minimum");
+    }
+    if (scale == Scale::Log && min <= 0) {
+        throw runtime_error("Log axis minimum must be positive");
+    }
+
+    edges.resize(n + 1);
+    if (scale == Scale::Linear) {
+        offset = min;
+        factor = n / (max - min);
+        for (int i = 0; i <= n; ++i) {
+            edges[i] = min + i * (max - min) / n;
+        }
+    } else {
+        offset = log(min);
+        factor = n / (log(max) - log(min));
+        for (int i = 0; i <= n; ++i) {
+            edges[i] = exp(log(min) + i * (log(max) - log(min)) / n);
+        }
+        edges[0] = min;
+        edges[n] = max;
+    }
+}
+
+Axis Axis::Parse(const string &specification) {
+    vector<string> fields;
+    stringstream stream(specification);
+    for (string field; getline(stream, field, ':');) {
+        fields.push_back(field);
+    }
+    if (fields.size() != 4 || (fields[0] != "lin" && fields[0] != "log")) {
+        throw runtime_error("Invalid axis '" + specification + "', expected 'lin:N:MIN:MAX' or 'log:N:MIN:MAX'");
+    }
+
+    try {
+        size_t end;
+        const int n = stoi(fields[1], &end);
+        if (end != fields[1].size()) {
+            throw invalid_argument(fields[1]);
+        }
+        const double min = stod(fields[2]);
+        const double max = stod(fields[3]);
+        return {fields[0] == "log" ? Scale::Log : Scale::Linear, n, min, max};
+    } catch (const logic_error &) {
+        throw runtime_error("Invalid axis '" + specification + "', expected 'lin:N:MIN:MAX' or 'log:N:MIN:MAX'");
+    }
+}
+
+string Axis::ToString() const {
+    ostringstream stream;
+    stream << (scale == Scale::Log ? "log" : "lin") << ":" << n << ":" << min << ":" << max;
+    return stream.str();
+}
+
+void Axis::FindBins(const double *x, int *bins, size_t size) const {
+    const double upper = n + 1;
+    if (scale == Scale::Linear) {
+        for (size_t i = 0; i < size; ++i) {
+            double u = (x[i] - offset) * factor + 1.0;
+            u = u > 0 ? u : 0;
+            u = u < upper ? u : upper;
+            bins[i] = (int) u;
+        }
+    } else {
+        for (size_t i = 0; i < size; ++i) {
+            double u = (log(x[i]) - offset) * factor + 1.0;
+            u = u > 0 ? u : 0;
+            u = u < upper ? u : upper;
+            bins[i] = (int) u;
+        }
+    }
+
+    for (size_t i = 0; i < size; ++i) {
+        bins[i] = Correct(x[i], bins[i]);
+    }
+}
+
+CosineLookup::CosineLookup(const Axis &angleAxis) {
+    const auto &edges = angleAxis.GetEdges();
+    if (edges.front() < 0 || edges.back() > 180) {
+        throw runtime_error("Angle axis must be within 0 and 180 degrees");
+    }
+
+    const int n = angleAxis.GetNbins();
+    cosineEdges.resize(n + 1);
+    for (int i = 0; i <= n; ++i) {
+        cosineEdges[i] = cos(edges[i] * M_PI / 180);
+    }
+
+    cells = std::max(4096, 8 * n);
+    cellsPerUnit = cells / 2.0;
+    table.resize(cells);
+    for (int cell = 0; cell < cells; ++cell) {
+        // cosine edges decrease with the angle, the bin is the number of edges at or above the cosine
+        const double cosine = -1.0 + cell / cellsPerUnit;
+        int bin = 0;
+        while (bin <= n && cosine <= cosineEdges[bin]) {
+            ++bin;
+        }
+        table[cell] = bin;
+    }
+}
+
+void CosineLookup::FindBins(const double *cosine, int *bins, size_t size) const {
+    for (size_t i = 0; i < size; ++i) {
+        bins[i] = FindBin(cosine[i]);
+    }
+}
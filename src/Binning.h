@@ -0,0 +1,111 @@
+
+#pragma once
+
+#include <cmath>
+#include <string>
+#include <vector>
+
+// Uniform axis in x (linear) or in log(x) (log). Bin lookup is a closed-form computation,
+// the edges are only used to correct the rounding so that results match a search over them.
+// Bins follow the ROOT convention: 0 is the underflow and n + 1 the overflow
+class Axis {
+public:
+    enum class Scale { Linear, Log };
+
+    Axis() = default;
+
+    Axis(Scale scale, int n, double min, double max);
+
+    // "lin:N:MIN:MAX" or "log:N:MIN:MAX"
+    static Axis Parse(const std::string& specification);
+
+    std::string ToString() const;
+
+    int FindBin(double x) const {
+        double u = ((scale == Scale::Log ? std::log(x) : x) - offset) * factor + 1.0;
+        u = u > 0 ? u : 0; // also catches NaN
+        u = u < n + 1 ? u : n + 1;
+        return Correct(x, (int) u);
+    }
+
+    // same as FindBin for a whole buffer. The arithmetic and the correction are split in two loops
+    // so that the first one is vectorized by the compiler
+    void FindBins(const double* x, int* bins, size_t size) const;
+
+    Scale GetScale() const { return scale; }
+
+    int GetNbins() const { return n; }
+
+    double GetMin() const { return min; }
+
+    double GetMax() const { return max; }
+
+    const std::vector<double>& GetEdges() const { return edges; }
+
+    double GetBinWidth(int bin) const { return edges[bin] - edges[bin - 1]; }
+
+private:
+    int Correct(double x, int bin) const {
+        if (bin > 0 && x < edges[bin - 1]) {
+            return bin - 1;
+        }
+        if (bin <= n && x >= edges[bin]) {
+            return bin + 1;
+        }
+        return bin;
+    }
+
+    Scale scale = Scale::Linear;
+    int n = 1;
+    double min = 0;
+    double max = 1;
+
+    // u = (f(x) - offset) * factor is the position in units of bins
+    double offset = 0;
+    double factor = 1;
+
+    std::vector<double> edges;
+};
+
+// Finds the bin of an angle axis (in degrees) from the cosine of the angle, without computing acos.
+// A lookup table over the cosine gives the highest bin in each cell, which is then corrected down
+// by comparing against the cosine of the edges. The table has several cells per bin so the walk is short
+class CosineLookup {
+public:
+    CosineLookup() = default;
+
+    explicit CosineLookup(const Axis& angleAxis);
+
+    int FindBin(double cosine) const {
+        double u = (cosine + 1.0) * cellsPerUnit;
+        u = u > 0 ? u : 0;
+        u = u < cells - 1 ? u : cells - 1;
+        int bin = table[(int) u];
+        while (bin > 0 && cosine > cosineEdges[bin - 1]) {
+            --bin;
+        }
+        return bin;
+    }
+
+    void FindBins(const double* cosine, int* bins, size_t size) const;
+
+private:
+    int cells = 1;
+    double cellsPerUnit = 0.5;
+
+    std::vector<int> table;
+    std::vector<double> cosineEdges;
+};
+
+// Axes of the histograms of one scored species: energy (MeV), zenith (degrees) and depth (mm)
+struct Binning {
+    Binning() = default;
+
+    Binning(const Axis& energy, const Axis& zenith, const Axis& depth)
+        : energy(energy), zenith(zenith), zenithLookup(zenith), depth(depth) {}
+
+    Axis energy;
+    Axis zenith;
+    CosineLookup zenithLookup;
+    Axis depth;
+};
@@ -0,0 +1,350 @@
+
+#include "Checkpoint.h"
+#include "Convergence.h"
+#include "PrimarySource.h"
+#include "RunAction.h"
+#include "ShardMerger.h"
+#include "SpeciesRegistry.h"
+
+#include <G4SystemOfUnits.hh>
+#include <Randomize.hh>
+
+#include <TFile.h>
+#include <TKey.h>
+#include <TObjString.h>
+
+#include <chrono>
+#include <cmath>
+#include <filesystem>
+#include <sstream>
+
+using namespace std;
+using namespace CLHEP;
+
+string Checkpoint::filename;
+double Checkpoint::interval = 600;
+const vector<Binning> *Checkpoint::binnings = nullptr;
+atomic<long long> Checkpoint::deadline = 0;
+atomic<int> Checkpoint::generation = 0;
+thread_local int Checkpoint::threadGeneration = 0;
+thread_local uint64_t Checkpoint::threadNextEventIndex = 0;
+mutex Checkpoint::snapshotMutex;
+unique_ptr<Checkpoint::Snapshot> Checkpoint::snapshot;
+int Checkpoint::activeThreads = 0;
+unique_ptr<Checkpoint::Snapshot> Checkpoint::endedThreads;
+mutex Checkpoint::writeMutex;
+int Checkpoint::writtenGeneration = 0;
+bool Checkpoint::resumed = false;
+Checkpoint::Totals Checkpoint::resumedTotals;
+uint64_t Checkpoint::resumedEventIndex = 0;
+double Checkpoint::resumedSourceThickness = 0;
+bool Checkpoint::resumedSurfaceSource = false;
+vector<string> Checkpoint::resumedEngineStates;
+map<string, unique_ptr<TH1>> Checkpoint::resumedHistograms;
+
+namespace {
+enum CounterBin { LaunchedPrimaries = 1, Secondaries, NextEventIndex, Culled };
+// one bin per culling reason from Culled on
+constexpr int numberOfCounterBins = Culled + (int) Culling::NumberOfReasons - 1;
+
+const string countersName = "checkpoint_counters";
+const string convergenceName = "checkpoint_convergence";
+const string enginePrefix = "checkpoint_engine_";
+
+long long Now() {
+    return chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now().time_since_epoch()).count();
+}
+}// namespace
+
+void Checkpoint::SetFilename(const string &name) {
+    filename = name;
+}
+
+void Checkpoint::SetInterval(double seconds) {
+    interval = seconds;
+}
+
+void Checkpoint::Resume(const string &name) {
+    const unique_ptr<TFile> file(TFile::Open(name.c_str(), "READ"));
+    if (file == nullptr || file->IsZombie()) {
+        throw runtime_error("Could not open checkpoint " + name);
+    }
+    const unique_ptr<TH1D> counters(file->Get<TH1D>(countersName.c_str()));
+    if (counters == nullptr) {
+        throw runtime_error(name + " is not a checkpoint, it has no " + countersName);
+    }
+    counters->SetDirectory(nullptr);
+    const auto metadata = ShardMerger::ReadMetadata(*file);
+
+    resumedTotals.launchedPrimaries = (unsigned long long) counters->GetBinContent(LaunchedPrimaries);
+    resumedTotals.secondaries = (unsigned long long) counters->GetBinContent(Secondaries);
+    for (int reason = 0; reason < Culling::NumberOfReasons; ++reason) {
+        resumedTotals.culled[reason] = (unsigned long long) counters->GetBinContent(Culled + reason);
+    }
+    resumedEventIndex = (uint64_t) counters->GetBinContent(NextEventIndex);
+    resumedSourceThickness = metadata.sourceThickness;
+    resumedSurfaceSource = metadata.surfaceSource;
+
+    if (const unique_ptr<TH1D> launched(file->Get<TH1D>("launched_primaries")); launched != nullptr) {
+        launched->SetDirectory(nullptr);
+        for (int bin = 1; bin <= launched->GetNbinsX(); ++bin) {
+            resumedTotals.launchedPerParticle.push_back((unsigned long long) launched->GetBinContent(bin));
+        }
+    }
+    if (const unique_ptr<TH1D> convergence(file->Get<TH1D>(convergenceName.c_str())); convergence != nullptr) {
+        convergence->SetDirectory(nullptr);
+        vector<double> state;
+        for (int bin = 1; bin <= convergence->GetNbinsX(); ++bin) {
+            state.push_back(convergence->GetBinContent(bin));
+        }
+        Convergence::SetResumedState(state);
+    }
+
+    for (int i = 0; i < file->GetListOfKeys()->GetSize(); ++i) {
+        const string key = file->GetListOfKeys()->At(i)->GetName();
+        if (key.starts_with(enginePrefix)) {
+            const unique_ptr<TObjString> state(file->Get<TObjString>(key.c_str()));
+            resumedEngineStates.emplace_back(state->GetString().Data());
+            continue;
+        }
+        // the species histograms, the other ones are rewritten from the counters
+        if (key.starts_with("checkpoint_") || key == ShardMerger::metadataName || key == ShardMerger::shardsName ||
+            key == "launched_primaries" || key == "source_activities") {
+            continue;
+        }
+        unique_ptr<TH1> histogram(file->Get<TH1>(key.c_str()));
+        if (histogram != nullptr) {
+            histogram->SetDirectory(nullptr);
+            resumedHistograms[key] = std::move(histogram);
+        }
+    }
+
+    resumed = true;
+    G4cout << "Resuming from checkpoint " << name << ": " << resumedTotals.launchedPrimaries << " primaries, "
+           << resumedTotals.secondaries << " secondaries" << G4endl;
+}
+
+void Checkpoint::AddResumed(TH1 *histogram) {
+    const auto it = resumedHistograms.find(histogram->GetName());
+    if (it != resumedHistograms.end()) {
+        histogram->Add(it->second.get());
+    }
+}
+
+void Checkpoint::Start(const vector<Binning> &runBinnings) {
+    binnings = &runBinnings;
+
+    if (resumed) {
+        if (resumedSurfaceSource != RunAction::IsSurfaceSource() ||
+            abs(resumedSourceThickness - RunAction::GetSourceThickness()) > 1e-9 * mm) {
+            throw runtime_error("The checkpoint was taken with a different source");
+        }
+        if (!resumedTotals.launchedPerParticle.empty() &&
+            resumedTotals.launchedPerParticle.size() != PrimarySource::GetNumberOfParticles()) {
+            throw runtime_error("The checkpoint was taken with different source particles");
+        }
+        // the histograms are added bin by bin
+        for (size_t i = 0; i < SpeciesRegistry::GetNumberOfSpecies(); ++i) {
+            const auto &name = SpeciesRegistry::GetSpecies(i).name;
+            const auto &binning = runBinnings[i];
+            for (const auto &[suffix, axis]: {pair{"_energy", binning.energy}, pair{"_zenith", binning.zenith},
+                                              pair{"_depth", binning.depth}}) {
+                const auto it = resumedHistograms.find(name + suffix);
+                if (it == resumedHistograms.end() || it->second->GetNbinsX() != axis.GetNbins()) {
+                    throw runtime_error("The checkpoint has no " + name + suffix +
+                                        " histogram with the binning of this run");
+                }
+            }
+        }
+    }
+
+    if (!IsEnabled()) {
+        return;
+    }
+    generation = 0;
+    writtenGeneration = 0;
+    snapshot.reset();
+    activeThreads = 0;
+    endedThreads = CreateSnapshot();
+    deadline = Now() + (long long) (interval * 1e9);
+}
+
+unique_ptr<Checkpoint::Snapshot> Checkpoint::CreateSnapshot() {
+    auto empty = make_unique<Snapshot>();
+    for (const auto &binning: *binnings) {
+        empty->histograms.emplace_back(binning);
+    }
+    empty->totals.launchedPerParticle.assign(PrimarySource::GetNumberOfParticles(), 0);
+    return empty;
+}
+
+void Checkpoint::AddThread(Snapshot &to) {
+    RunAction::AddToSnapshot(to);
+    ostringstream state;
+    G4Random::getTheEngine()->put(state);
+    to.engineStates.push_back(state.str());
+    to.nextEventIndex = max(to.nextEventIndex, threadNextEventIndex);
+}
+
+void Checkpoint::BeginOfThread() {
+    if (!IsEnabled()) {
+        return;
+    }
+    lock_guard<std::mutex> lock(snapshotMutex);
+    ++activeThreads;
+    // without any event yet, the checkpoint in progress is completed without this thread
+    threadGeneration = generation;
+    threadNextEventIndex = 0;
+}
+
+void Checkpoint::EndOfThread() {
+    if (!IsEnabled()) {
+        return;
+    }
+    unique_ptr<Snapshot> completed;
+    {
+        lock_guard<std::mutex> lock(snapshotMutex);
+        --activeThreads;
+        AddThread(*endedThreads);
+        // the checkpoint in progress is not waiting for this thread anymore, its final state stands in for it
+        if (snapshot != nullptr && threadGeneration != generation) {
+            AddThread(*snapshot);
+            threadGeneration = generation;
+            if (--snapshot->pendingThreads == 0) {
+                completed = std::move(snapshot);
+            }
+        }
+    }
+    if (completed != nullptr) {
+        Write(*completed);
+    }
+}
+
+void Checkpoint::EndOfEvent(uint64_t eventIndex) {
+    threadNextEventIndex = max(threadNextEventIndex, eventIndex + 1);
+
+    // the first thread past the deadline starts the next checkpoint
+    bool start = false;
+    if (generation.load(memory_order_acquire) == threadGeneration) {
+        auto due = deadline.load(memory_order_relaxed);
+        const auto now = Now();
+        if (now < due || !deadline.compare_exchange_strong(due, now + (long long) (interval * 1e9))) {
+            return;
+        }
+        start = true;
+    }
+
+    unique_ptr<Snapshot> completed;
+    {
+        lock_guard<std::mutex> lock(snapshotMutex);
+        if (start) {
+            // a thread which does not reach the end of an event holds back the checkpoint, which is then replaced
+            snapshot = CreateSnapshot();
+            const auto &ended = *endedThreads;
+            for (size_t i = 0; i < ended.histograms.size(); ++i) {
+                snapshot->histograms[i].Add(ended.histograms[i]);
+            }
+            snapshot->totals = ended.totals;
+            snapshot->engineStates = ended.engineStates;
+            snapshot->nextEventIndex = ended.nextEventIndex;
+            snapshot->pendingThreads = activeThreads;
+            snapshot->generation = ++generation;
+        }
+        threadGeneration = generation;
+        if (snapshot == nullptr) {
+            return;
+        }
+        AddThread(*snapshot);
+        if (--snapshot->pendingThreads == 0) {
+            completed = std::move(snapshot);
+        }
+    }
+    // the other threads go on with their events while it is written
+    if (completed != nullptr) {
+        Write(*completed);
+    }
+}
+
+void Checkpoint::Write(const Snapshot &snapshot) {
+    lock_guard<std::mutex> lock(writeMutex);
+    if (snapshot.generation < writtenGeneration) {
+        // a later checkpoint has been written already
+        return;
+    }
+    writtenGeneration = snapshot.generation;
+
+    auto totals = snapshot.totals;
+    totals.launchedPrimaries += resumedTotals.launchedPrimaries;
+    totals.secondaries += resumedTotals.secondaries;
+    for (int reason = 0; reason < Culling::NumberOfReasons; ++reason) {
+        totals.culled[reason] += resumedTotals.culled[reason];
+    }
+    for (size_t i = 0; i < resumedTotals.launchedPerParticle.size(); ++i) {
+        totals.launchedPerParticle[i] += resumedTotals.launchedPerParticle[i];
+    }
+
+    // written next to the checkpoint, so the rename does not cross file systems
+    const auto temporaryFilename = filename + ".tmp";
+    {
+        TFile file(temporaryFilename.c_str(), "RECREATE");
+        if (file.IsZombie()) {
+            G4cout << "Warning: could not write checkpoint " << temporaryFilename << G4endl;
+            return;
+        }
+
+        // histograms created while the file is the current directory are owned and written by it
+        for (size_t i = 0; i < snapshot.histograms.size(); ++i) {
+            const auto &species = SpeciesRegistry::GetSpecies(i);
+            const auto histograms = snapshot.histograms[i].CreateROOTHistograms(species.name, species.label);
+            for (const auto histogram: {(TH1 *) histograms.energy, (TH1 *) histograms.zenith,
+                                        (TH1 *) histograms.energyZenith, (TH1 *) histograms.depth}) {
+                AddResumed(histogram);
+            }
+        }
+
+        ShardMerger::WriteMetadata(RunAction::GetEquivalentPrimaries(totals.launchedPrimaries),
+                                   RunAction::GetSourceThickness(), RunAction::IsSurfaceSource(), 0, 1);
+        if (PrimarySource::GetNumberOfParticles() > 0) {
+            RunAction::WriteSourceSummary(totals.launchedPerParticle);
+        }
+
+        auto counters = new TH1D(countersName.c_str(), "Counters of the run", numberOfCounterBins, 0,
+                                 numberOfCounterBins);
+        counters->GetXaxis()->SetBinLabel(LaunchedPrimaries, "launched_primaries");
+        counters->GetXaxis()->SetBinLabel(Secondaries, "secondaries");
+        counters->GetXaxis()->SetBinLabel(NextEventIndex, "next_event_index");
+        counters->SetBinContent(LaunchedPrimaries, (double) totals.launchedPrimaries);
+        counters->SetBinContent(Secondaries, (double) totals.secondaries);
+        counters->SetBinContent(NextEventIndex, (double) max(snapshot.nextEventIndex, resumedEventIndex));
+        for (int reason = 0; reason < Culling::NumberOfReasons; ++reason) {
+            counters->GetXaxis()->SetBinLabel(Culled + reason,
+                                              ("culled_" + string(Culling::GetReasonName(reason))).c_str());
+            counters->SetBinContent(Culled + reason, (double) totals.culled[reason]);
+        }
+
+        if (Convergence::IsEnabled()) {
+            const auto state = Convergence::GetState();
+            auto convergence = new TH1D(convergenceName.c_str(), "Batches and sums of the convergence targets",
+                                        (int) state.size(), 0, (double) state.size());
+            for (size_t i = 0; i < state.size(); ++i) {
+                convergence->SetBinContent((int) i + 1, state[i]);
+            }
+        }
+
+        for (size_t i = 0; i < snapshot.engineStates.size(); ++i) {
+            TObjString state(snapshot.engineStates[i].c_str());
+            file.WriteTObject(&state, (enginePrefix + to_string(i)).c_str());
+        }
+
+        file.Write();
+        file.Close();
+    }
+
+    error_code error;
+    filesystem::rename(temporaryFilename, filename, error);
+    if (error) {
+        G4cout << "Warning: could not replace checkpoint " << filename << ": " << error.message() << G4endl;
+        return;
+    }
+    G4cout << "Checkpoint written to " << filename << ": " << totals.launchedPrimaries << " primaries" << G4endl;
+}
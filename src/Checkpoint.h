@@ -0,0 +1,116 @@
+
+#pragma once
+
+#include "Culling.h"
+#include "SpeciesHistograms.h"
+
+#include <TH1.h>
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// Periodically writes the state of the run to a file, to resume it after an interruption. The file is a shard file
+// (unnormalized histograms and the metadata to normalize them, see ShardMerger) with the counters, the state of the
+// random engines and of the convergence targets added, so the merge command turns any checkpoint into a normalized
+// snapshot of the spectra. Every thread running events adds its own histograms to the checkpoint at the end of an
+// event, or its final ones when its event loop ends first. The last one writes it to a temporary file, which then
+// replaces the previous checkpoint
+class Checkpoint {
+public:
+    static void SetFilename(const std::string& filename);
+
+    static void SetInterval(double seconds);
+
+    static bool IsEnabled() { return !filename.empty(); }
+
+    // counts of the run a checkpoint was taken of
+    struct Totals {
+        unsigned long long launchedPrimaries = 0;
+        unsigned long long secondaries = 0;
+        std::array<unsigned long long, Culling::NumberOfReasons> culled{};
+        // indexed by the PrimarySource particle
+        std::vector<unsigned long long> launchedPerParticle;
+    };
+
+    // what each thread adds to a checkpoint
+    struct Snapshot {
+        Totals totals;
+        // indexed by the SpeciesRegistry slot
+        std::vector<SpeciesHistograms> histograms;
+        std::vector<std::string> engineStates;
+        uint64_t nextEventIndex = 0;
+        // the threads active when it was started which have not added themselves yet
+        int pendingThreads = 0;
+        int generation = 0;
+    };
+
+    // reads a checkpoint, this run then continues from it
+    static void Resume(const std::string& filename);
+
+    static bool IsResumed() { return resumed; }
+
+    static const Totals& GetResumedTotals() { return resumedTotals; }
+
+    // index from which the events of this run are seeded, past every event of the checkpoint
+    static uint64_t GetResumedEventIndex() { return resumedEventIndex; }
+
+    static const std::vector<std::string>& GetResumedEngineStates() { return resumedEngineStates; }
+
+    // adds the histogram of the same name in the checkpoint, if any
+    static void AddResumed(TH1* histogram);
+
+    // called by the master at the beginning of the run, the binning of the resumed histograms must be the same
+    static void Start(const std::vector<Binning>& binnings);
+
+    // called by every thread running events before its first event and once its event loop has ended
+    static void BeginOfThread();
+    static void EndOfThread();
+
+    // called on every thread at the end of each event, with the global index of the event
+    static void EndOfEvent(uint64_t eventIndex);
+
+private:
+    // empty, with the binning of the run
+    static std::unique_ptr<Snapshot> CreateSnapshot();
+
+    // adds the histograms, counters and random engine of the calling thread, the caller holds the snapshot mutex
+    static void AddThread(Snapshot& snapshot);
+
+    static void Write(const Snapshot& snapshot);
+
+    static std::string filename;
+    static double interval;
+    // of the run, must not be resized while checkpoints are taken
+    static const std::vector<Binning>* binnings;
+
+    // the thread which finds the deadline passed starts a new checkpoint by increasing the generation
+    static std::atomic<long long> deadline;
+    static std::atomic<int> generation;
+    static thread_local int threadGeneration;
+    static thread_local uint64_t threadNextEventIndex;
+
+    // guards the snapshot in progress, the ended threads and the number of active ones
+    static std::mutex snapshotMutex;
+    static std::unique_ptr<Snapshot> snapshot;
+    static int activeThreads;
+    // final state of the threads whose event loop has ended, every later checkpoint starts from it
+    static std::unique_ptr<Snapshot> endedThreads;
+
+    // a thread which has ended writes without being waited for, so the next checkpoint may complete meanwhile
+    static std::mutex writeMutex;
+    static int writtenGeneration;
+
+    static bool resumed;
+    static Totals resumedTotals;
+    static uint64_t resumedEventIndex;
+    static double resumedSourceThickness;
+    static bool resumedSurfaceSource;
+    static std::vector<std::string> resumedEngineStates;
+    static std::map<std::string, std::unique_ptr<TH1>> resumedHistograms;
+};
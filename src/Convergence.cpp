@@ -0,0 +1,218 @@
+
+#include "Convergence.h"
+#include "RunAction.h"
+#include "SpeciesRegistry.h"
+
+#include <G4ios.hh>
+
+#include <cmath>
+#include <limits>
+#include <sstream>
+#include <stdexcept>
+
+using namespace std;
+
+vector<Convergence::Target> Convergence::targets;
+int Convergence::batchSize = 1000;
+unsigned long long Convergence::batches = 0;
+unsigned long long Convergence::resumedBatches = 0;
+mutex Convergence::batchMutex;
+atomic<bool> Convergence::converged = false;
+chrono::steady_clock::time_point Convergence::start;
+vector<double> Convergence::resumedState;
+thread_local vector<double> Convergence::batchSums;
+thread_local int Convergence::batchEvents = 0;
+
+namespace {
+// fewer batches give an unreliable estimate of their spread
+constexpr unsigned long long minBatches = 10;
+}// namespace
+
+void Convergence::SetTargets(const vector<string> &specifications) {
+    const auto error = [](const string &specification) {
+        return runtime_error("Invalid convergence target '" + specification + "', expected 'SPECIES[:EMIN:EMAX]=REL'");
+    };
+
+    targets.clear();
+    for (const auto &specification: specifications) {
+        const auto separator = specification.find('=');
+        if (separator == string::npos) {
+            throw error(specification);
+        }
+        vector<string> fields;
+        stringstream stream(specification.substr(0, separator));
+        for (string field; getline(stream, field, ':');) {
+            fields.push_back(field);
+        }
+        if ((fields.size() != 1 && fields.size() != 3) || fields[0].empty()) {
+            throw error(specification);
+        }
+
+        Target target;
+        target.particleName = fields[0];
+        try {
+            target.minEnergy = fields.size() == 3 ? stod(fields[1]) : 0;
+            target.maxEnergy = fields.size() == 3 ? stod(fields[2]) : numeric_limits<double>::infinity();
+            target.relativeUncertainty = stod(specification.substr(separator + 1));
+        } catch (const logic_error &) {
+            throw error(specification);
+        }
+        if (target.minEnergy >= target.maxEnergy || target.relativeUncertainty <= 0) {
+            throw error(specification);
+        }
+        targets.push_back(target);
+    }
+}
+
+void Convergence::SetBatchSize(int events) {
+    batchSize = events;
+}
+
+void Convergence::Initialize() {
+    for (auto &target: targets) {
+        target.species = -1;
+        for (size_t i = 0; i < SpeciesRegistry::GetNumberOfSpecies(); ++i) {
+            if (SpeciesRegistry::GetSpecies(i).particleName == target.particleName) {
+                target.species = (int) i;
+            }
+        }
+        if (target.species < 0) {
+            throw runtime_error("Convergence target given for species " + target.particleName + ", which is not scored");
+        }
+        target.sum = 0;
+        target.sumSquares = 0;
+    }
+    batches = 0;
+    resumedBatches = 0;
+    converged = false;
+    start = chrono::steady_clock::now();
+
+    if (resumedState.empty()) {
+        return;
+    }
+    if (resumedState.size() != 1 + 2 * targets.size()) {
+        throw runtime_error("The convergence targets are not the ones of the checkpoint");
+    }
+    batches = (unsigned long long) resumedState[0];
+    resumedBatches = batches;
+    for (size_t t = 0; t < targets.size(); ++t) {
+        targets[t].sum = resumedState[1 + 2 * t];
+        targets[t].sumSquares = resumedState[2 + 2 * t];
+    }
+}
+
+void Convergence::ScoreEvent(const SecondaryHitsCollection *hits) {
+    if (batchSums.size() != targets.size()) {
+        batchSums.assign(targets.size(), 0);
+        batchEvents = 0;
+    }
+
+    if (hits != nullptr) {
+        const auto n = hits->entries();
+        for (size_t i = 0; i < n; ++i) {
+            const auto hit = (*hits)[i];
+            for (size_t t = 0; t < targets.size(); ++t) {
+                const auto &target = targets[t];
+                if (hit->species == target.species && hit->energy >= target.minEnergy &&
+                    hit->energy < target.maxEnergy) {
+                    batchSums[t] += hit->weight;
+                }
+            }
+        }
+    }
+
+    if (++batchEvents < batchSize) {
+        return;
+    }
+
+    bool done;
+    {
+        lock_guard<std::mutex> lock(batchMutex);
+        ++batches;
+        done = true;
+        for (size_t t = 0; t < targets.size(); ++t) {
+            auto &target = targets[t];
+            target.sum += batchSums[t];
+            target.sumSquares += batchSums[t] * batchSums[t];
+            done = done && GetRelativeUncertainty(target) <= target.relativeUncertainty;
+        }
+    }
+    batchSums.assign(targets.size(), 0);
+    batchEvents = 0;
+
+    if (done && !converged.exchange(true)) {
+        RunAction::RequestAbort();
+    }
+}
+
+vector<double> Convergence::GetState() {
+    lock_guard<std::mutex> lock(batchMutex);
+    vector<double> state = {(double) batches};
+    for (const auto &target: targets) {
+        state.push_back(target.sum);
+        state.push_back(target.sumSquares);
+    }
+    return state;
+}
+
+void Convergence::SetResumedState(const vector<double> &state) {
+    resumedState = state;
+}
+
+double Convergence::GetRelativeUncertainty(const Target &target) {
+    if (batches < minBatches || target.sum <= 0) {
+        return numeric_limits<double>::infinity();
+    }
+    const auto n = (double) batches;
+    const auto mean = target.sum / n;
+    const auto variance = max(0.0, (target.sumSquares / n - mean * mean) * n / (n - 1));
+    return sqrt(variance / n) / mean;
+}
+
+string Convergence::GetProgress() {
+    const auto elapsed = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+    lock_guard<std::mutex> lock(batchMutex);
+    // the uncertainty falls as the square root of the number of events
+    const auto batchesPerSecond = (double) (batches - resumedBatches) / elapsed;
+    double remaining = 0;
+    stringstream line;
+    line << "Convergence:";
+    for (const auto &target: targets) {
+        const auto uncertainty = GetRelativeUncertainty(target);
+        line << " " << target.particleName;
+        if (target.minEnergy > 0 || isfinite(target.maxEnergy)) {
+            line << "[" << target.minEnergy << ", " << target.maxEnergy << ") MeV";
+        }
+        line << " ";
+        if (isfinite(uncertainty)) {
+            line << 100 * uncertainty;
+        } else {
+            line << "-";
+        }
+        line << "% / " << 100 * target.relativeUncertainty << "%";
+        const auto ratio = uncertainty / target.relativeUncertainty;
+        if (isfinite(ratio) && batchesPerSecond > 0) {
+            remaining = max(remaining, (double) batches * (ratio * ratio - 1) / batchesPerSecond);
+        } else {
+            remaining = numeric_limits<double>::infinity();
+        }
+    }
+    if (isfinite(remaining)) {
+        line << " ETA: " << (long long) remaining << " s";
+    } else {
+        line << " ETA: unknown";
+    }
+    return line.str();
+}
+
+void Convergence::PrintSummary() {
+    lock_guard<std::mutex> lock(batchMutex);
+    G4cout << "Convergence " << (converged ? "reached" : "not reached") << " after " << batches << " batches of "
+           << batchSize << " events" << G4endl;
+    for (const auto &target: targets) {
+        G4cout << "    " << target.particleName << " [" << target.minEnergy << ", " << target.maxEnergy
+               << ") MeV: relative uncertainty " << GetRelativeUncertainty(target) << " (target "
+               << target.relativeUncertainty << ")" << G4endl;
+    }
+}
@@ -0,0 +1,72 @@
+
+#pragma once
+
+#include "SecondaryHit.h"
+
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// Stops the run once the scored flux of every target reaches its relative uncertainty. The uncertainty is estimated
+// with batch means: each thread sums the weights scored in the target over batches of consecutive events, and the
+// spread of the batch sums gives the uncertainty of their mean
+class Convergence {
+public:
+    // "SPECIES[:EMIN:EMAX]=REL", e.g. "neutron=0.05" or "gamma:0.01:0.1=0.02", energies in MeV
+    static void SetTargets(const std::vector<std::string>& specifications);
+
+    static void SetBatchSize(int events);
+
+    static bool IsEnabled() { return !targets.empty(); }
+
+    // called by the master once the species are registered, before the workers start
+    static void Initialize();
+
+    // called at the end of every event, also the ones without hits (nullptr)
+    static void ScoreEvent(const SecondaryHitsCollection* hits);
+
+    static bool IsConverged() { return converged; }
+
+    // uncertainty of each target and the projected time until the slowest one converges
+    static std::string GetProgress();
+
+    static void PrintSummary();
+
+    // number of batches and sums of every target, to resume them from a checkpoint
+    static std::vector<double> GetState();
+
+    // applied by Initialize, the targets must be the same
+    static void SetResumedState(const std::vector<double>& state);
+
+private:
+    struct Target {
+        std::string particleName;
+        double minEnergy;
+        double maxEnergy;
+        double relativeUncertainty;
+        // SpeciesRegistry slot
+        int species = -1;
+        // over the completed batches of all threads
+        double sum = 0;
+        double sumSquares = 0;
+    };
+
+    // infinite until there are enough batches with hits, the caller holds the mutex
+    static double GetRelativeUncertainty(const Target& target);
+
+    static std::vector<Target> targets;
+    static int batchSize;
+    static unsigned long long batches;
+    // batches of a resumed checkpoint, which were not made in the time of this run
+    static unsigned long long resumedBatches;
+    static std::mutex batchMutex;
+    static std::atomic<bool> converged;
+    static std::chrono::steady_clock::time_point start;
+    static std::vector<double> resumedState;
+
+    // sums of the batch in progress on this thread, one per target
+    static thread_local std::vector<double> batchSums;
+    static thread_local int batchEvents;
+};
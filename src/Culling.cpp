@@ -0,0 +1,98 @@
+
+#include "Culling.h"
+#include "DetectorConstruction.h"
+
+#include <G4Positron.hh>
+#include <G4SystemOfUnits.hh>
+
+#include <algorithm>
+
+using namespace std;
+using namespace CLHEP;
+
+double Culling::rangeCullingMaxEnergy = 0;
+bool Culling::upstreamCulling = false;
+vector<Culling::Layer> Culling::layers;
+double Culling::detectorZ = 0;
+thread_local unique_ptr<G4EmCalculator> Culling::calculator;
+
+const char *Culling::GetReasonName(int reason) {
+    switch (reason) {
+        case Neutrino:
+            return "neutrino";
+        case Range:
+            return "range";
+        case Upstream:
+            return "upstream";
+        default:
+            return "unknown";
+    }
+}
+
+void Culling::SetRangeCullingMaxEnergy(double energy) {
+    rangeCullingMaxEnergy = energy * MeV;
+}
+
+void Culling::SetUpstreamCulling(bool enabled) {
+    upstreamCulling = enabled;
+}
+
+void Culling::Initialize() {
+    const auto &stack = DetectorConstruction::GetLayers();
+    detectorZ = DetectorConstruction::GetThickness();
+
+    layers.clear();
+    for (const auto &[zLow, zHigh, material]: stack) {
+        layers.push_back({zLow, zHigh, {}});
+    }
+    // walking upstream, each layer adds its material to the ones downstream of it
+    vector<const G4Material *> materials;
+    for (int i = (int) stack.size() - 1; i >= 0; --i) {
+        if (find(materials.begin(), materials.end(), stack[i].material) == materials.end()) {
+            materials.push_back(stack[i].material);
+        }
+        layers[i].materials = materials;
+    }
+
+    if (IsRangeCullingEnabled()) {
+        G4cout << "Range culling of charged tracks below " << rangeCullingMaxEnergy / MeV << " MeV" << G4endl;
+    }
+    if (IsUpstreamCullingEnabled()) {
+        G4cout << "Culling of tracks leaving the stack upstream" << G4endl;
+    }
+}
+
+bool Culling::IsOutOfRange(const G4Track *track) {
+    const auto particle = track->GetParticleDefinition();
+    const auto energy = track->GetKineticEnergy();
+    // positrons annihilate into photons and unstable particles or ions decay, their products may reach the detector
+    if (energy >= rangeCullingMaxEnergy || particle->GetPDGCharge() == 0 || particle == G4Positron::Definition() ||
+        !particle->GetPDGStable() || particle->IsGeneralIon()) {
+        return false;
+    }
+
+    const auto z = track->GetPosition().z();
+    const auto layer = find_if(layers.begin(), layers.end(), [z](const Layer &layer) { return z < layer.zHigh; });
+    if (layer == layers.end() || z < layer->zLow) {
+        return false;
+    }
+
+    if (calculator == nullptr) {
+        calculator = make_unique<G4EmCalculator>();
+    }
+    // the restricted range is longer than the CSDA one, which keeps the cut conservative
+    const auto distance = detectorZ - z;
+    for (const auto material: layer->materials) {
+        if (calculator->GetRangeFromRestricteDEDX(energy, particle, material) >= distance) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool Culling::HasLeftUpstream(const G4Step *step) {
+    const auto postStepPoint = step->GetPostStepPoint();
+    const auto volume = postStepPoint->GetPhysicalVolume();
+    // the world is the only volume without a mother, nothing brings a track back to the stack through its vacuum
+    return volume != nullptr && volume->GetMotherLogical() == nullptr && postStepPoint->GetPosition().z() < detectorZ;
+}
@@ -0,0 +1,55 @@
+
+#pragma once
+
+#include <G4EmCalculator.hh>
+#include <G4Material.hh>
+#include <G4Step.hh>
+#include <G4Track.hh>
+
+#include <memory>
+#include <vector>
+
+// Kills tracks that can not contribute to the scoring: charged particles whose range is shorter than the distance
+// to the detector and tracks leaving the stack upstream, into the vacuum of the world
+class Culling {
+public:
+    enum Reason { Neutrino, Range, Upstream, NumberOfReasons };
+
+    static const char* GetReasonName(int reason);
+
+    // charged tracks below this kinetic energy (MeV) are culled by range, 0 disables it.
+    // Above it they may still radiate photons which reach the detector
+    static void SetRangeCullingMaxEnergy(double energy);
+
+    static void SetUpstreamCulling(bool enabled);
+
+    static bool IsRangeCullingEnabled() { return rangeCullingMaxEnergy > 0; }
+
+    static bool IsUpstreamCullingEnabled() { return upstreamCulling; }
+
+    // called by the master once the geometry is built
+    static void Initialize();
+
+    // the range of the track, in the least stopping of the materials between it and the detector,
+    // is shorter than its distance to the detector plane
+    static bool IsOutOfRange(const G4Track* track);
+
+    static bool HasLeftUpstream(const G4Step* step);
+
+private:
+    static double rangeCullingMaxEnergy;
+    static bool upstreamCulling;
+
+    struct Layer {
+        double zLow;
+        double zHigh;
+        // distinct materials of this layer and the ones downstream of it
+        std::vector<const G4Material*> materials;
+    };
+
+    static std::vector<Layer> layers;
+    static double detectorZ;
+
+    // created on the first use of each thread
+    static thread_local std::unique_ptr<G4EmCalculator> calculator;
+};
@@ -0,0 +1,105 @@
+
+#include "DepthSampler.h"
+#include "HistogramReader.h"
+
+#include <G4SystemOfUnits.hh>
+
+#include <cmath>
+
+using namespace std;
+using namespace CLHEP;
+
+DepthSampler::Mode DepthSampler::mode = DepthSampler::Mode::Uniform;
+double DepthSampler::thickness = 0;
+double DepthSampler::length = 0;
+double DepthSampler::exponentialNormalization = 1;
+vector<double> DepthSampler::pdfEdges;
+vector<double> DepthSampler::pdfContents;
+vector<double> DepthSampler::binLow;
+vector<double> DepthSampler::binHigh;
+vector<double> DepthSampler::binWeights;
+AliasTable DepthSampler::table;
+
+void DepthSampler::SetExponential(double newLength) {
+    if (!(newLength > 0)) {
+        throw runtime_error("Depth bias length must be positive");
+    }
+    mode = Mode::Exponential;
+    length = newLength * mm;
+}
+
+void DepthSampler::LoadPDF(const string &filename) {
+    const auto histogram = ReadHistogram(filename);
+    if (histogram->GetDimension() != 1) {
+        throw runtime_error("Depth bias density must be a TH1 of the depth (mm)");
+    }
+
+    mode = Mode::PDF;
+    const auto axis = histogram->GetXaxis();
+    pdfEdges.clear();
+    pdfContents.clear();
+    for (int bin = 1; bin <= axis->GetNbins(); ++bin) {
+        pdfEdges.push_back(axis->GetBinLowEdge(bin) * mm);
+        pdfContents.push_back(histogram->GetBinContent(bin));
+    }
+    pdfEdges.push_back(axis->GetBinUpEdge(axis->GetNbins()) * mm);
+}
+
+void DepthSampler::Initialize(double newThickness) {
+    thickness = newThickness;
+
+    if (mode == Mode::Exponential) {
+        exponentialNormalization = 1 - exp(-thickness / length);
+        G4cout << "Depth sampling biased towards the detector with an exponential of length " << length / mm << " mm"
+               << G4endl;
+    } else if (mode == Mode::PDF) {
+        // decays can only be sampled where the density is positive, it must cover the whole stack to stay unbiased
+        if (pdfEdges.front() > 0 || pdfEdges.back() < thickness) {
+            throw runtime_error("Depth bias density must cover the whole stack, from 0 to " +
+                                to_string(thickness / mm) + " mm");
+        }
+        binLow.clear();
+        binHigh.clear();
+        vector<double> probabilities;
+        for (size_t bin = 0; bin < pdfContents.size(); ++bin) {
+            const auto low = max(pdfEdges[bin], 0.0);
+            const auto high = min(pdfEdges[bin + 1], thickness);
+            if (high <= low) {
+                continue;
+            }
+            if (!(pdfContents[bin] > 0)) {
+                throw runtime_error("Depth bias density must be positive over the whole stack");
+            }
+            binLow.push_back(low);
+            binHigh.push_back(high);
+            probabilities.push_back(pdfContents[bin] / (pdfEdges[bin + 1] - pdfEdges[bin]) * (high - low));
+        }
+        table = AliasTable(probabilities);
+
+        // uniform density over the sampled one, constant within a bin
+        binWeights.clear();
+        for (size_t bin = 0; bin < probabilities.size(); ++bin) {
+            binWeights.push_back((binHigh[bin] - binLow[bin]) * table.GetTotal() / (probabilities[bin] * thickness));
+        }
+        G4cout << "Depth sampling biased with a density of " << probabilities.size() << " bins" << G4endl;
+    }
+}
+
+void DepthSampler::Sample(double u1, double u2, double &depth, double &weight) {
+    switch (mode) {
+        case Mode::Uniform:
+            depth = u1 * thickness;
+            weight = 1;
+            break;
+        case Mode::Exponential:
+            depth = -length * log(1 - u1 * exponentialNormalization);
+            weight = length * exponentialNormalization * exp(depth / length) / thickness;
+            break;
+        case Mode::PDF: {
+            const auto bin = table.Sample(u1);
+            depth = binLow[bin] + u2 * (binHigh[bin] - binLow[bin]);
+            weight = binWeights[bin];
+            break;
+        }
+    }
+}
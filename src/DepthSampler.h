@@ -0,0 +1,46 @@
+
+#pragma once
+
+#include "AliasTable.h"
+
+#include <string>
+#include <vector>
+
+// Distance from the decay to the detector plane. Uniform over the stack by default, or biased towards the detector
+// with an exponential or a user given density, in which case each decay carries the weight (ratio of the uniform
+// density to the sampled one) that keeps the scored quantities unbiased
+class DepthSampler {
+public:
+    // density proportional to exp(-depth / length), length in mm
+    static void SetExponential(double length);
+
+    // probability of each bin from the contents of a TH1 of the depth (mm), uniform within a bin
+    static void LoadPDF(const std::string& filename);
+
+    static bool IsBiased() { return mode != Mode::Uniform; }
+
+    // called by the master once the stack is built
+    static void Initialize(double thickness);
+
+    // u1 and u2 uniform in [0, 1)
+    static void Sample(double u1, double u2, double& depth, double& weight);
+
+private:
+    enum class Mode { Uniform, Exponential, PDF };
+
+    static Mode mode;
+    static double thickness;
+
+    static double length;
+    // probability of the exponential over the stack, 1 - exp(-thickness / length)
+    static double exponentialNormalization;
+
+    // histogram as read, then its bins clipped to the stack
+    static std::vector<double> pdfEdges;
+    static std::vector<double> pdfContents;
+    static std::vector<double> binLow;
+    static std::vector<double> binHigh;
+    // weight of a decay in each clipped bin
+    static std::vector<double> binWeights;
+    static AliasTable table;
+};
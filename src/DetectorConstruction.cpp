@@ -1,34 +1,53 @@
 
 #include "DetectorConstruction.h"
 #include "SensitiveDetector.h"
+#include "StartupProfile.h"
 
 #include <G4LogicalVolumeStore.hh>
 #include <G4NistManager.hh>
 #include <G4PhysicalVolumeStore.hh>
+#include <G4SDManager.hh>
+#include <G4Threading.hh>
 
 #include <random>
+#include <G4IStore.hh>
 #include <G4PVPlacement.hh>
+#include <G4ProductionCuts.hh>
+#include <G4Region.hh>
 #include <G4RunManager.hh>
+#include <G4UserLimits.hh>
 
 using namespace std;
 using namespace CLHEP;
 
+double DetectorConstruction::slabThickness = 0;
+bool DetectorConstruction::fastInit = false;
+const string DetectorConstruction::customMaterialsFilename = "../materials/materials.xml";
+double DetectorConstruction::productionCut = 1 * mm;
+double DetectorConstruction::farProductionCut = 0;
+double DetectorConstruction::farMinKineticEnergy = 0;
+double DetectorConstruction::importanceRatio = 0;
+
 DetectorConstruction::DetectorConstruction(const std::vector<std::pair<std::string, double>> &configuration)
         : G4VUserDetectorConstruction(), configuration(configuration) {
-        LoadCustomMaterialsFromXML("../materials/materials.xml");
+    // with fast initialization the file is only parsed if a material is not a NIST one
+    if (!fastInit) {
+        LoadCustomMaterialsFromXML(customMaterialsFilename);
+    }
 }
 
 
 G4VPhysicalVolume *DetectorConstruction::Construct() {
+    StartupProfile::Start("geometry");
+
     // build a basic detector
     auto nist = G4NistManager::Instance();
     const auto vacuum = nist->FindOrBuildMaterial("G4_Galactic");
 
-     // check all the materials are valid
+     // check all the materials are valid, each one is resolved once
+    vector<G4Material *> materials;
     for (const auto &[material, thickness]: configuration) {
-        if (GetMaterialOrCustom(material) == nullptr) {
-            throw runtime_error("Material " + material + " not found");
-        }
+        materials.push_back(GetMaterialOrCustom(material));
         if (thickness < 0) {
             throw runtime_error("Thickness cannot be negative");
         }
@@ -43,9 +62,11 @@ G4VPhysicalVolume *DetectorConstruction::Construct() {
     world = new G4PVPlacement(nullptr, {}, worldLogical, "World", nullptr, false, 0);
 
     totalThickness = 0;
+    layers.clear();
+    slabs.clear();
     for (size_t i = 0; i < configuration.size(); ++i) {
         const auto &config = configuration[i];
-        G4Material* material = GetMaterialOrCustom(config.first);
+        G4Material* material = materials[i];
         double thickness = config.second * mm;
 
         cout << "Layer " << i << ": " << thickness/mm << " mm of " << material->GetName() << endl;
@@ -55,31 +76,153 @@ G4VPhysicalVolume *DetectorConstruction::Construct() {
             continue;
         }
 
-        auto solid = new G4Box("Layer" + to_string(i), width / 2, width / 2, thickness / 2);
-        auto logical = new G4LogicalVolume(solid, material, "Layer" + to_string(i));
-        new G4PVPlacement(nullptr, {0, 0, totalThickness + thickness / 2}, logical, "Layer" + to_string(i),
-                          worldLogical, false, 0);
+        // each slab has its own logical volume so that it can be its own region,
+        // copy numbers count the slabs of the whole stack
+        const auto nSlabs = slabThickness > 0 ? (int) ceil(thickness / (slabThickness * mm) - 1e-9) : 1;
+        const auto thicknessOfSlab = thickness / nSlabs;
+        auto solid = new G4Box("Layer" + to_string(i), width / 2, width / 2, thicknessOfSlab / 2);
+        for (int j = 0; j < nSlabs; ++j) {
+            auto logical = new G4LogicalVolume(solid, material, "Layer" + to_string(i));
+            slabs.push_back(new G4PVPlacement(nullptr, {0, 0, totalThickness + (j + 0.5) * thicknessOfSlab}, logical,
+                                              "Layer" + to_string(i), worldLogical, false, (int) slabs.size()));
+        }
+        if (nSlabs > 1) {
+            cout << "Layer " << i << " split in " << nSlabs << " slabs of " << thicknessOfSlab / mm << " mm" << endl;
+        }
 
+        layers.push_back({totalThickness, totalThickness + thickness, material});
         totalThickness += thickness;
     }
 
     auto detectorSolid = new G4Box("Detector", width / 2, width / 2, detectorThickness / 2);
     auto detectorLogical = new G4LogicalVolume(detectorSolid, vacuum, "Detector");
-    new G4PVPlacement(nullptr, {0, 0, totalThickness + detectorThickness / 2}, detectorLogical, "Detector",
-                      worldLogical, false, 0);
+    detector = new G4PVPlacement(nullptr, {0, 0, totalThickness + detectorThickness / 2}, detectorLogical,
+                                 "Detector", worldLogical, false, 0);
 
-    // check for overlaps (not sure if this actually works)
-    if (world->CheckOverlaps(1000, 0, true)) {
-        throw runtime_error("Overlaps found in geometry");
+    if (farProductionCut > 0 || farMinKineticEnergy > 0) {
+        CreateRegions();
     }
 
+    StartupProfile::Start("overlap check");
+    if (fastInit) {
+        CheckOverlapsAlongZ(detectorThickness, width);
+    } else {
+        // check for overlaps (not sure if this actually works)
+        if (world->CheckOverlaps(1000, 0, true)) {
+            throw runtime_error("Overlaps found in geometry");
+        }
+    }
+    StartupProfile::Stop("overlap check");
+    StartupProfile::Stop("geometry");
+
     return world;
 }
 
 void DetectorConstruction::ConstructSDandField() {
     auto detectorLogical = G4LogicalVolumeStore::GetInstance()->GetVolume("Detector");
     auto detector = new SensitiveDetector("Detector");
+    // registration is needed for the hits collection to be created every event
+    G4SDManager::GetSDMpointer()->AddNewDetector(detector);
     SetSensitiveDetector(detectorLogical, detector);
+
+    if (importanceRatio > 0) {
+        CreateImportanceStore();
+    }
+}
+
+void DetectorConstruction::SetSlabThickness(double thickness) {
+    slabThickness = thickness;
+}
+
+void DetectorConstruction::SetFastInit(bool enabled) {
+    fastInit = enabled;
+}
+
+void DetectorConstruction::CheckOverlapsAlongZ(double detectorThickness, double width) const {
+    // every daughter of the world is a full width box, so they overlap only if their extents along z do
+    auto previousHigh = -width / 2;
+    auto check = [&previousHigh, width](const G4VPhysicalVolume *volume, double halfThickness) {
+        const auto z = volume->GetTranslation().z();
+        // placements accumulate rounding errors along the stack
+        constexpr double tolerance = 1e-9 * mm;
+        if (z - halfThickness < previousHigh - tolerance || z + halfThickness > width / 2) {
+            throw runtime_error("Overlaps found in geometry: " + volume->GetName());
+        }
+        previousHigh = z + halfThickness;
+    };
+    for (const auto slab: slabs) {
+        check(slab, ((const G4Box *) slab->GetLogicalVolume()->GetSolid())->GetZHalfLength());
+    }
+    check(detector, detectorThickness / 2);
+}
+
+void DetectorConstruction::SetProductionCuts(double cut, double farCut) {
+    productionCut = cut * mm;
+    farProductionCut = farCut * mm;
+}
+
+void DetectorConstruction::SetFarMinKineticEnergy(double energy) {
+    farMinKineticEnergy = energy * MeV;
+}
+
+void DetectorConstruction::CreateRegions() {
+    // the cut grows geometrically from the one next to the detector to the far one at the upstream face,
+    // evaluated at the downstream face of each slab, which is its closest point to the detector
+    const auto farCut = farProductionCut > 0 ? farProductionCut : productionCut;
+    for (const auto slab: slabs) {
+        const auto logical = slab->GetLogicalVolume();
+        const auto halfThickness = ((const G4Box *) logical->GetSolid())->GetZHalfLength();
+        const auto distance = totalThickness - (slab->GetTranslation().z() + halfThickness);
+        const auto fraction = distance / totalThickness;
+
+        auto region = new G4Region("Slab" + to_string(slab->GetCopyNo()));
+        region->AddRootLogicalVolume(logical);
+
+        const auto cut = productionCut * pow(farCut / productionCut, fraction);
+        auto cuts = new G4ProductionCuts;
+        cuts->SetProductionCut(cut);
+        region->SetProductionCuts(cuts);
+
+        // only applied with the G4StepLimiterPhysics constructor registered
+        const auto minKineticEnergy = farMinKineticEnergy * fraction;
+        if (minKineticEnergy > 0) {
+            auto limits = new G4UserLimits;
+            limits->SetUserMinEkine(minKineticEnergy);
+            region->SetUserLimits(limits);
+        }
+
+        G4cout << "Region " << region->GetName() << " (" << distance / mm << " mm from the detector): production cut "
+               << cut / mm << " mm, minimum kinetic energy " << minKineticEnergy / MeV << " MeV" << G4endl;
+    }
+}
+
+void DetectorConstruction::SetImportanceRatio(double ratio) {
+    importanceRatio = ratio;
+}
+
+void DetectorConstruction::CreateImportanceStore() const {
+    auto store = G4IStore::GetInstance();
+
+    // tracks leaving the stack upstream go back to the importance of the first slab
+    store->AddImportanceGeometryCell(1, *world);
+    double importance = 1;
+    for (const auto slab: slabs) {
+        store->AddImportanceGeometryCell(importance, *slab, slab->GetCopyNo());
+        importance *= importanceRatio;
+    }
+    store->AddImportanceGeometryCell(importance / importanceRatio, *detector);
+
+    // the same on every thread
+    if (G4Threading::G4GetThreadId() > 0) {
+        return;
+    }
+    G4cout << "Importance biasing over " << slabs.size() << " cells, importance from 1 to "
+           << importance / importanceRatio << G4endl;
+}
+
+const vector<DetectorConstruction::Layer> &DetectorConstruction::GetLayers() {
+    auto detectorConstruction = (DetectorConstruction *) G4RunManager::GetRunManager()->GetUserDetectorConstruction();
+    return detectorConstruction->layers;
 }
 
 double DetectorConstruction::GetThickness() {
@@ -88,6 +231,7 @@ double DetectorConstruction::GetThickness() {
 }
 
 void DetectorConstruction::LoadCustomMaterialsFromXML(const std::string& filename) {
+    StartupProfile::Start("custom materials");
     TXMLEngine xml;
     XMLDocPointer_t doc = xml.ParseFile(filename.c_str());
     if (!doc) {
@@ -197,6 +341,8 @@ void DetectorConstruction::LoadCustomMaterialsFromXML(const std::string& filenam
     }
 
     xml.FreeDoc(doc);
+    customMaterialsLoaded = true;
+    StartupProfile::Stop("custom materials");
 }
 
 
@@ -204,6 +350,10 @@ G4Material* DetectorConstruction::GetMaterialOrCustom(const std::string& name) {
     auto nist = G4NistManager::Instance();
     G4Material* material = nist->FindOrBuildMaterial(name, false);
 
+    if (!material && !customMaterialsLoaded) {
+        LoadCustomMaterialsFromXML(customMaterialsFilename);
+    }
+
     if (!material) {
         auto it = customMaterials.find(name);
         if (it != customMaterials.end()) {
@@ -215,6 +365,10 @@ G4Material* DetectorConstruction::GetMaterialOrCustom(const std::string& name) {
         throw std::runtime_error("Material '" + name + "' not found in NIST or custom definitions.");
     }
 
+    if (fastInit) {
+        return material;
+    }
+
     G4cout << "\n[Material Info] Selected material: " << material->GetName() << G4endl;
     G4cout << "  Density: " << material->GetDensity() / (g/cm3) << G4endl;
     G4cout << "  State: " << material->GetState() << G4endl;
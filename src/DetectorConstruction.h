@@ -29,14 +29,65 @@ public:
 
     static double GetThickness();
 
+    struct Layer {
+        double zLow;
+        double zHigh;
+        const G4Material* material;
+    };
+
+    // ordered from the upstream face (z = 0) to the detector
+    static const std::vector<Layer> &GetLayers();
+
+    // layers are split in slabs no thicker than this (mm), 0 keeps one slab per layer
+    static void SetSlabThickness(double thickness);
+
+    // skips the material dumps, parses the custom materials only when needed and replaces the random point
+    // overlap check by an analytic one, which is exact for a stack of slabs
+    static void SetFastInit(bool enabled);
+
+    // production cut (mm) next to the detector, growing geometrically with the distance to reach farCut
+    // at the upstream face. Each slab is then its own region, farCut 0 keeps the same cut everywhere
+    static void SetProductionCuts(double cut, double farCut);
+
+    // charged tracks below this kinetic energy (MeV) are killed at the upstream face, the threshold goes down
+    // linearly to 0 at the detector. Needs G4StepLimiterPhysics
+    static void SetFarMinKineticEnergy(double energy);
+
+    static bool HasUserLimits() { return farMinKineticEnergy > 0; }
+
+    // importance of each slab is ratio times the one upstream of it, 0 disables the importance biasing.
+    // Needs a G4ImportanceBiasing constructor per biased particle
+    static void SetImportanceRatio(double ratio);
+
 private:
     G4VPhysicalVolume *world = nullptr;
+    G4VPhysicalVolume *detector = nullptr;
+
+    std::vector<Layer> layers;
+    // ordered from the upstream face to the detector
+    std::vector<G4VPhysicalVolume *> slabs;
+
+    static double slabThickness;
+    static bool fastInit;
+    static double productionCut;
+    static double farProductionCut;
+    static double farMinKineticEnergy;
+    static double importanceRatio;
+
+    void CreateRegions();
+
+    // the store is thread local, so it is filled on every thread once its navigator has the world
+    void CreateImportanceStore() const;
 
     const std::vector<std::pair<std::string, double>> configuration;
 
     double totalThickness = 0;
 
+    static const std::string customMaterialsFilename;
     std::map<std::string, G4Material*> customMaterials;
+    bool customMaterialsLoaded = false;
+
+    void CheckOverlapsAlongZ(double detectorThickness, double width) const;
 
     void LoadCustomMaterialsFromXML(const std::string& filename);
     G4Material* GetMaterialOrCustom(const std::string& name);
@@ -1,7 +1,13 @@
 
 #include "EventAction.h"
 
+#include "Checkpoint.h"
+#include "Convergence.h"
 #include "RunAction.h"
+#include "SecondaryWriter.h"
+#include "SensitiveDetector.h"
+
+#include <G4SDManager.hh>
 
 #include <iostream>
 
@@ -12,4 +18,32 @@ EventAction::EventAction() : G4UserEventAction() {}
 
 void EventAction::BeginOfEventAction(const G4Event *event) {}
 
-void EventAction::EndOfEventAction(const G4Event *event) {}
+void EventAction::EndOfEventAction(const G4Event *event) {
+    if (hitsCollectionID < 0) {
+        hitsCollectionID = G4SDManager::GetSDMpointer()->GetCollectionID(
+                string("Detector/") + SensitiveDetector::hitsCollectionName);
+    }
+
+    const SecondaryHitsCollection *hits = nullptr;
+    auto hitsCollectionOfThisEvent = event->GetHCofThisEvent();
+    if (hitsCollectionOfThisEvent != nullptr) {
+        hits = static_cast<SecondaryHitsCollection *>(hitsCollectionOfThisEvent->GetHC(hitsCollectionID));
+        if (hits != nullptr) {
+            RunAction::InsertHits(*hits);
+            if (SecondaryWriter::IsEnabled()) {
+                SecondaryWriter::Insert(*hits, RunAction::GetEventIndex());
+            }
+        }
+    }
+
+    // events without hits count in the batches too
+    if (Convergence::IsEnabled()) {
+        Convergence::ScoreEvent(hits);
+    }
+
+    if (Checkpoint::IsEnabled()) {
+        Checkpoint::EndOfEvent(RunAction::GetEventIndex());
+    }
+
+    RunAction::CheckSecondariesQuota();
+}
@@ -11,6 +11,9 @@ public:
     void BeginOfEventAction(const G4Event *) override;
 
     void EndOfEventAction(const G4Event *) override;
+
+private:
+    G4int hitsCollectionID = -1;
 };
 
 
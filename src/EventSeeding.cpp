@@ -0,0 +1,36 @@
+
+#include "EventSeeding.h"
+
+#include <Randomize.hh>
+
+using namespace std;
+
+bool EventSeeding::enabled = false;
+uint64_t EventSeeding::seed = 0;
+uint64_t EventSeeding::eventOffset = 0;
+
+namespace {
+// SplitMix64 finalizer, consecutive inputs give uncorrelated outputs
+uint64_t Mix(uint64_t x) {
+    x += 0x9E3779B97F4A7C15ULL;
+    x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    x = (x ^ (x >> 27)) * 0x94D049BB133111EBULL;
+    return x ^ (x >> 31);
+}
+}// namespace
+
+void EventSeeding::SetSeed(uint64_t seed) {
+    EventSeeding::seed = seed;
+    enabled = true;
+}
+
+void EventSeeding::SetEventOffset(uint64_t offset) {
+    eventOffset = offset;
+}
+
+void EventSeeding::SeedEvent(uint64_t eventIndex) {
+    const auto hash = Mix(Mix(seed) ^ eventIndex);
+    // two positive, non zero seeds terminated by 0, as the run manager seeds the events itself
+    const long seeds[3] = {(long) (hash >> 33) + 1, (long) ((hash >> 2) & 0x7FFFFFFF) + 1, 0};
+    G4Random::setTheSeeds(seeds, -1);
+}
@@ -0,0 +1,26 @@
+
+#pragma once
+
+#include <cstdint>
+
+// Seeds the random engine of every event from the run seed and the global index of the event alone, so the
+// random stream of an event does not depend on the thread it runs on or on how the events are split in processes
+class EventSeeding {
+public:
+    static void SetSeed(uint64_t seed);
+
+    static bool IsEnabled() { return enabled; }
+
+    // global index of the first event of this process
+    static void SetEventOffset(uint64_t offset);
+
+    static uint64_t GetEventOffset() { return eventOffset; }
+
+    // called on the thread of the event before anything is sampled
+    static void SeedEvent(uint64_t eventIndex);
+
+private:
+    static bool enabled;
+    static uint64_t seed;
+    static uint64_t eventOffset;
+};
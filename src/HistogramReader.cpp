@@ -0,0 +1,37 @@
+
+#include "HistogramReader.h"
+
+#include <TClass.h>
+#include <TFile.h>
+#include <TKey.h>
+
+#include <stdexcept>
+
+using namespace std;
+
+unique_ptr<TH1> ReadHistogram(const string &filename, const string &histogramName) {
+    unique_ptr<TFile> file(TFile::Open(filename.c_str(), "READ"));
+    if (file == nullptr || file->IsZombie()) {
+        throw runtime_error("Could not open input file " + filename);
+    }
+
+    TH1 *histogram = nullptr;
+    if (!histogramName.empty()) {
+        histogram = file->Get<TH1>(histogramName.c_str());
+    } else {
+        for (int i = 0; i < file->GetListOfKeys()->GetSize() && histogram == nullptr; ++i) {
+            const auto key = (TKey *) file->GetListOfKeys()->At(i);
+            // only histograms are read, the other objects are skipped without being loaded
+            const auto objectClass = TClass::GetClass(key->GetClassName());
+            if (objectClass != nullptr && objectClass->InheritsFrom(TH1::Class())) {
+                histogram = (TH1 *) key->ReadObj();
+            }
+        }
+    }
+    if (histogram == nullptr) {
+        throw runtime_error("No histogram '" + histogramName + "' found in input file " + filename);
+    }
+
+    histogram->SetDirectory(nullptr);
+    return unique_ptr<TH1>(histogram);
+}
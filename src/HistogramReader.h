@@ -0,0 +1,11 @@
+
+#pragma once
+
+#include <TH1.h>
+
+#include <memory>
+#include <string>
+
+// Reads a histogram from a ROOT file, the first one in the file if no name is given.
+// The histogram is detached from the file, which is closed
+std::unique_ptr<TH1> ReadHistogram(const std::string& filename, const std::string& histogramName = "");
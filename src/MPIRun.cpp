@@ -0,0 +1,186 @@
+
+#include "MPIRun.h"
+#include "RunAction.h"
+
+#ifdef WITH_MPI
+#include <mpi.h>
+#endif
+
+#include <TArrayD.h>
+
+#include <algorithm>
+#include <limits>
+#include <numeric>
+
+using namespace std;
+
+int MPIRun::rank = 0;
+int MPIRun::size = 1;
+int MPIRun::blockSize = 1000;
+uint64_t MPIRun::totalEvents = 0;
+
+uint64_t MPIRun::nextEvent = 0;
+vector<unsigned long long> MPIRun::secondariesPerRank;
+mutex MPIRun::allocationMutex;
+thread MPIRun::server;
+
+uint64_t MPIRun::blockNext = 0;
+uint64_t MPIRun::blockEnd = 0;
+bool MPIRun::finished = false;
+mutex MPIRun::blockMutex;
+
+namespace {
+enum Tag { RequestTag = 1, BlockTag };
+}// namespace
+
+void MPIRun::Initialize(int *argc, char ***argv) {
+#ifdef WITH_MPI
+    // calls are serialized: by the block mutex on each rank, and on rank 0 the server thread runs alone
+    // between the start and the end of the run
+    int provided;
+    MPI_Init_thread(argc, argv, MPI_THREAD_SERIALIZED, &provided);
+    if (provided < MPI_THREAD_SERIALIZED) {
+        throw runtime_error("The MPI library does not support calls from several threads");
+    }
+    MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+    MPI_Comm_size(MPI_COMM_WORLD, &size);
+#endif
+}
+
+void MPIRun::Finalize() {
+#ifdef WITH_MPI
+    MPI_Finalize();
+#endif
+}
+
+void MPIRun::SetBlockSize(int events) {
+    blockSize = events;
+}
+
+void MPIRun::SetTotalEvents(uint64_t events) {
+    totalEvents = events;
+}
+
+void MPIRun::Start() {
+    blockNext = 0;
+    blockEnd = 0;
+    finished = false;
+    if (rank == 0) {
+        nextEvent = 0;
+        secondariesPerRank.assign(size, 0);
+        if (IsEnabled()) {
+            server = thread(Serve);
+        }
+    }
+}
+
+MPIRun::Block MPIRun::Allocate(int fromRank, unsigned long long secondaries) {
+    lock_guard<mutex> lock(allocationMutex);
+    secondariesPerRank[fromRank] = secondaries;
+
+    const auto requestedSecondaries = (unsigned long long) RunAction::GetRequestedSecondaries();
+    const auto totalSecondaries = accumulate(secondariesPerRank.begin(), secondariesPerRank.end(), 0ULL);
+    if (requestedSecondaries > 0 && totalSecondaries >= requestedSecondaries) {
+        return {0, 0};
+    }
+
+    const auto last = totalEvents > 0 ? totalEvents : numeric_limits<uint64_t>::max();
+    const auto count = min<uint64_t>(blockSize, last - nextEvent);
+    const Block block = {nextEvent, count};
+    nextEvent += count;
+    return block;
+}
+
+void MPIRun::Serve() {
+#ifdef WITH_MPI
+    // until every other rank has been told there is nothing left
+    int remaining = size - 1;
+    while (remaining > 0) {
+        unsigned long long request[2];
+        MPI_Status status;
+        MPI_Recv(request, 2, MPI_UNSIGNED_LONG_LONG, MPI_ANY_SOURCE, RequestTag, MPI_COMM_WORLD, &status);
+        const auto [secondaries, leaving] = request;
+
+        auto block = Allocate(status.MPI_SOURCE, secondaries);
+        if (leaving) {
+            block = {0, 0};
+        }
+        const unsigned long long reply[2] = {block.first, block.count};
+        MPI_Send(reply, 2, MPI_UNSIGNED_LONG_LONG, status.MPI_SOURCE, BlockTag, MPI_COMM_WORLD);
+        remaining -= block.count == 0;
+    }
+#endif
+}
+
+MPIRun::Block MPIRun::RequestBlock(bool leaving) {
+#ifdef WITH_MPI
+    const unsigned long long request[2] = {RunAction::GetSecondariesCount(), leaving};
+    MPI_Send(request, 2, MPI_UNSIGNED_LONG_LONG, 0, RequestTag, MPI_COMM_WORLD);
+    unsigned long long reply[2];
+    MPI_Recv(reply, 2, MPI_UNSIGNED_LONG_LONG, 0, BlockTag, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
+    return {reply[0], reply[1]};
+#else
+    return {0, 0};
+#endif
+}
+
+long long MPIRun::NextEvent() {
+    lock_guard<mutex> lock(blockMutex);
+    if (finished) {
+        return -1;
+    }
+    if (blockNext == blockEnd) {
+        const auto [first, count] = rank == 0 ? Allocate(0, RunAction::GetSecondariesCount()) : RequestBlock(false);
+        if (count == 0) {
+            finished = true;
+            return -1;
+        }
+        blockNext = first;
+        blockEnd = first + count;
+    }
+    return (long long) blockNext++;
+}
+
+void MPIRun::Finish() {
+    if (rank == 0) {
+        if (server.joinable()) {
+            server.join();
+        }
+        return;
+    }
+    // a rank whose run ended for another reason must still be accounted for by the server
+    lock_guard<mutex> lock(blockMutex);
+    if (!finished) {
+        RequestBlock(true);
+        finished = true;
+    }
+}
+
+void MPIRun::Reduce(TH1 *histogram) {
+#ifdef WITH_MPI
+    // every rank has the squared weights, even where all the weights were 1
+    if (histogram->GetSumw2N() == 0) {
+        histogram->Sumw2();
+    }
+    const auto n = histogram->GetNcells();
+    const auto root = rank == 0;
+
+    auto contents = dynamic_cast<TArrayD *>(histogram)->GetArray();
+    MPI_Reduce(root ? MPI_IN_PLACE : contents, contents, n, MPI_DOUBLE, MPI_SUM, 0, MPI_COMM_WORLD);
+    auto sumw2 = histogram->GetSumw2()->GetArray();
+    MPI_Reduce(root ? MPI_IN_PLACE : sumw2, sumw2, n, MPI_DOUBLE, MPI_SUM, 0, MPI_COMM_WORLD);
+
+    double entries = histogram->GetEntries();
+    MPI_Reduce(root ? MPI_IN_PLACE : &entries, &entries, 1, MPI_DOUBLE, MPI_SUM, 0, MPI_COMM_WORLD);
+    if (root) {
+        histogram->SetEntries(entries);
+    }
+#endif
+}
+
+void MPIRun::Reduce(vector<unsigned long long> &values) {
+#ifdef WITH_MPI
+    MPI_Reduce(rank == 0 ? MPI_IN_PLACE : values.data(), values.data(), (int) values.size(), MPI_UNSIGNED_LONG_LONG,
+               MPI_SUM, 0, MPI_COMM_WORLD);
+#endif
+}
@@ -0,0 +1,77 @@
+
+#pragma once
+
+#include <TH1.h>
+
+#include <cstdint>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Runs the simulation over the ranks of an MPI job. Rank 0 hands out blocks of consecutive event indices on demand
+// to every rank, itself included, until the primaries or the secondaries quota are reached, so faster ranks run
+// more events. The secondaries quota is only checked when a rank asks for a block, so it is overshot by the
+// secondaries of up to a block per rank. The results are then reduced to rank 0, which alone writes the output.
+// Without WITH_MPI, or with a single rank, every call falls back to a plain run
+class MPIRun {
+public:
+    // called first in main, the program must be started with mpirun
+    static void Initialize(int* argc, char*** argv);
+
+    static void Finalize();
+
+    static bool IsEnabled() { return size > 1; }
+
+    static int GetRank() { return rank; }
+
+    static int GetSize() { return size; }
+
+    static void SetBlockSize(int events);
+
+    // events of the whole job, 0 when the run stops on the secondaries quota instead
+    static void SetTotalEvents(uint64_t events);
+
+    // called by the master of every rank before its workers start
+    static void Start();
+
+    // global index of the next event to run on this rank, -1 once there are none left
+    static long long NextEvent();
+
+    // called by the master of every rank after its workers are done, before any reduction
+    static void Finish();
+
+    // sums the contents, squared weights and entries of the histogram of every rank into the one of rank 0
+    static void Reduce(TH1* histogram);
+
+    static void Reduce(std::vector<unsigned long long>& values);
+
+private:
+    static int rank;
+    static int size;
+    static int blockSize;
+    static uint64_t totalEvents;
+
+    struct Block {
+        uint64_t first;
+        uint64_t count;
+    };
+
+    // on rank 0: the next block for a rank, given its current number of secondaries
+    static Block Allocate(int fromRank, unsigned long long secondaries);
+
+    static Block RequestBlock(bool leaving);
+
+    static void Serve();
+
+    // rank 0 only
+    static uint64_t nextEvent;
+    static std::vector<unsigned long long> secondariesPerRank;
+    static std::mutex allocationMutex;
+    static std::thread server;
+
+    // current block of this rank
+    static uint64_t blockNext;
+    static uint64_t blockEnd;
+    static bool finished;
+    static std::mutex blockMutex;
+};
@@ -0,0 +1,128 @@
+
+#include "PhaseSpace.h"
+
+#include <G4SystemOfUnits.hh>
+
+#include <cstring>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using namespace std;
+using namespace CLHEP;
+
+string PhaseSpaceWriter::outputFilename;
+FILE *PhaseSpaceWriter::file = nullptr;
+uint64_t PhaseSpaceWriter::records = 0;
+mutex PhaseSpaceWriter::fileMutex;
+thread_local vector<PhaseSpaceRecord> PhaseSpaceWriter::buffer;
+
+const PhaseSpaceHeader *PhaseSpaceReader::header = nullptr;
+const PhaseSpaceRecord *PhaseSpaceReader::records = nullptr;
+
+void PhaseSpaceWriter::SetOutputFilename(const string &filename) {
+    outputFilename = filename;
+}
+
+void PhaseSpaceWriter::Open() {
+    file = fopen(outputFilename.c_str(), "wb");
+    if (file == nullptr) {
+        throw runtime_error("Could not open phase-space output file " + outputFilename);
+    }
+    records = 0;
+
+    // placeholder, rewritten once the number of records is known
+    const PhaseSpaceHeader header;
+    if (fwrite(&header, sizeof(header), 1, file) != 1) {
+        throw runtime_error("Could not write to phase-space output file " + outputFilename);
+    }
+}
+
+void PhaseSpaceWriter::Write(const G4Step *step, double depth) {
+    const auto track = step->GetTrack();
+    const auto &position = step->GetPreStepPoint()->GetPosition();
+    const auto &direction = track->GetMomentumDirection();
+
+    buffer.push_back({track->GetParticleDefinition()->GetPDGEncoding(), (float) track->GetWeight(),
+                      track->GetKineticEnergy() / MeV, (float) (position.x() / mm), (float) (position.y() / mm),
+                      (float) direction.x(), (float) direction.y(), (float) direction.z(), (float) (depth / mm)});
+
+    if (buffer.size() >= bufferSize) {
+        Flush();
+    }
+}
+
+void PhaseSpaceWriter::Flush() {
+    if (buffer.empty()) {
+        return;
+    }
+    lock_guard<mutex> lock(fileMutex);
+    if (fwrite(buffer.data(), sizeof(PhaseSpaceRecord), buffer.size(), file) != buffer.size()) {
+        throw runtime_error("Could not write to phase-space output file " + outputFilename);
+    }
+    records += buffer.size();
+    buffer.clear();
+}
+
+void PhaseSpaceWriter::Close(double launchedPrimaries, double sourceThickness, bool surfaceSource) {
+    PhaseSpaceHeader header;
+    header.recordSize = sizeof(PhaseSpaceRecord);
+    header.records = records;
+    header.launchedPrimaries = launchedPrimaries;
+    header.sourceThickness = sourceThickness / mm;
+    header.surfaceSource = surfaceSource;
+
+    // a file whose header was not rewritten would look like a valid one without records
+    const auto headerWritten = fseek(file, 0, SEEK_SET) == 0 && fwrite(&header, sizeof(header), 1, file) == 1;
+    const auto closed = fclose(file) == 0;
+    file = nullptr;
+    if (!headerWritten || !closed) {
+        throw runtime_error("Could not write phase-space output file " + outputFilename);
+    }
+
+    G4cout << "Phase-space file " << outputFilename << ": " << records << " records" << G4endl;
+}
+
+void PhaseSpaceReader::Open(const string &filename) {
+    const auto descriptor = open(filename.c_str(), O_RDONLY);
+    if (descriptor < 0) {
+        throw runtime_error("Could not open phase-space input file " + filename);
+    }
+    struct stat status{};
+    if (fstat(descriptor, &status) != 0) {
+        close(descriptor);
+        throw runtime_error("Could not stat phase-space input file " + filename);
+    }
+    const auto size = (size_t) status.st_size;
+    if (size < sizeof(PhaseSpaceHeader)) {
+        close(descriptor);
+        throw runtime_error("Phase-space input file " + filename + " is too small");
+    }
+
+    // mapped for the whole lifetime of the program
+    const auto data = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, descriptor, 0);
+    close(descriptor);
+    if (data == MAP_FAILED) {
+        throw runtime_error("Could not map phase-space input file " + filename);
+    }
+    madvise(data, size, MADV_SEQUENTIAL);
+
+    header = (const PhaseSpaceHeader *) data;
+    if (memcmp(header->magic, PhaseSpaceHeader().magic, sizeof(header->magic)) != 0 ||
+        header->headerSize != sizeof(PhaseSpaceHeader) || header->recordSize != sizeof(PhaseSpaceRecord)) {
+        throw runtime_error("Invalid phase-space input file " + filename);
+    }
+    if (size < sizeof(PhaseSpaceHeader) + header->records * sizeof(PhaseSpaceRecord)) {
+        throw runtime_error("Phase-space input file " + filename + " is truncated");
+    }
+    records = (const PhaseSpaceRecord *) ((const char *) data + sizeof(PhaseSpaceHeader));
+
+    G4cout << "Phase-space file " << filename << ": " << header->records << " records from "
+           << header->launchedPrimaries << " primaries in " << header->sourceThickness << " mm" << G4endl;
+}
+
+const PhaseSpaceRecord *PhaseSpaceReader::Get(uint64_t index) {
+    return index < header->records ? &records[index] : nullptr;
+}
@@ -0,0 +1,93 @@
+
+#pragma once
+
+#include <G4Step.hh>
+
+#include <cstdint>
+#include <cstdio>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// Binary phase-space file of the particles crossing the detector plane: a fixed size header followed by fixed size
+// records, in the byte order of the machine that wrote it. Positions are in the plane of the detector
+struct PhaseSpaceHeader {
+    char magic[8] = {'R', 'D', 'S', 'P', 'H', 'S', 'P', '1'};
+    uint32_t headerSize = sizeof(PhaseSpaceHeader);
+    uint32_t recordSize = 0;
+    uint64_t records = 0;
+    // primaries launched in the source to produce the records, used to normalize the replayed runs
+    double launchedPrimaries = 0;
+    // thickness (mm) of the stack the primaries were launched in
+    double sourceThickness = 0;
+    // primaries launched from the upstream face instead of decaying inside the stack
+    uint32_t surfaceSource = 0;
+    uint32_t reserved = 0;
+};
+
+struct PhaseSpaceRecord {
+    int32_t pdg;
+    float weight;
+    // kinetic energy (MeV)
+    double energy;
+    // position (mm) in the detector plane
+    float x;
+    float y;
+    float directionX;
+    float directionY;
+    float directionZ;
+    // distance (mm) from the decay to the detector plane
+    float depth;
+};
+
+static_assert(sizeof(PhaseSpaceRecord) == 40, "phase-space records must have a fixed size");
+
+// Appends the tracks reaching the detector to the phase-space file. Each thread buffers its records
+// and writes them in blocks, the header is written when the file is closed
+class PhaseSpaceWriter {
+public:
+    static void SetOutputFilename(const std::string& filename);
+
+    static bool IsEnabled() { return !outputFilename.empty(); }
+
+    // called by the master before the workers start
+    static void Open();
+
+    // the track as it enters the detector
+    static void Write(const G4Step* step, double depth);
+
+    // writes the records buffered by the calling thread
+    static void Flush();
+
+    // called by the master after the workers are done
+    static void Close(double launchedPrimaries, double sourceThickness, bool surfaceSource);
+
+private:
+    static constexpr size_t bufferSize = 4096;
+
+    static std::string outputFilename;
+    static FILE* file;
+    static uint64_t records;
+    static std::mutex fileMutex;
+
+    static thread_local std::vector<PhaseSpaceRecord> buffer;
+};
+
+// Memory maps a phase-space file and gives any thread access to its records, without copying them
+class PhaseSpaceReader {
+public:
+    static void Open(const std::string& filename);
+
+    static bool IsEnabled() { return records != nullptr; }
+
+    // nullptr past the last record
+    static const PhaseSpaceRecord* Get(uint64_t index);
+
+    static const PhaseSpaceHeader& GetHeader() { return *header; }
+
+    static uint64_t GetNumberOfRecords() { return header->records; }
+
+private:
+    static const PhaseSpaceHeader* header;
+    static const PhaseSpaceRecord* records;
+};
@@ -0,0 +1,123 @@
+
+#include "PhysicsCache.h"
+#include "DetectorConstruction.h"
+
+#include <G4Material.hh>
+#include <G4ProductionCuts.hh>
+#include <G4Region.hh>
+#include <G4RegionStore.hh>
+#include <G4SystemOfUnits.hh>
+#include <G4Version.hh>
+
+#include <filesystem>
+#include <fstream>
+#include <iomanip>
+#include <sstream>
+
+#include <unistd.h>
+
+using namespace std;
+using namespace CLHEP;
+
+string PhysicsCache::directory;
+string PhysicsCache::key;
+string PhysicsCache::keyDirectory;
+bool PhysicsCache::retrieved = false;
+
+namespace {
+// FNV-1a, stable across compilers and runs unlike std::hash
+uint64_t Hash(const string &text) {
+    uint64_t hash = 14695981039346656037ULL;
+    for (const auto c: text) {
+        hash = (hash ^ (unsigned char) c) * 1099511628211ULL;
+    }
+    return hash;
+}
+
+const string keyFilename = "key.txt";
+}// namespace
+
+void PhysicsCache::SetDirectory(const string &directory) {
+    PhysicsCache::directory = directory;
+}
+
+string PhysicsCache::CreateKey(const string &preset) {
+    ostringstream stream;
+    stream << setprecision(17);
+    stream << "geant4 " << G4VERSION_NUMBER << "\n";
+    stream << "preset " << preset << "\n";
+
+    // regions are created with the geometry, before the tables are built
+    for (const auto region: *G4RegionStore::GetInstance()) {
+        stream << "region " << region->GetName();
+        if (const auto cuts = region->GetProductionCuts(); cuts != nullptr) {
+            for (const auto cut: cuts->GetProductionCuts()) {
+                stream << " " << cut / mm;
+            }
+        }
+        stream << "\n";
+    }
+
+    // custom materials may change under the same name, their composition is part of the key
+    for (const auto &layer: DetectorConstruction::GetLayers()) {
+        const auto material = layer.material;
+        stream << "material " << material->GetName() << " " << material->GetDensity() / (g / cm3);
+        const auto fractions = material->GetFractionVector();
+        for (size_t i = 0; i < material->GetNumberOfElements(); ++i) {
+            stream << " " << material->GetElement((G4int) i)->GetName() << " " << fractions[i];
+        }
+        stream << "\n";
+    }
+    return stream.str();
+}
+
+void PhysicsCache::Retrieve(G4VUserPhysicsList *physicsList, const string &preset) {
+    key = CreateKey(preset);
+    ostringstream name;
+    name << hex << setw(16) << setfill('0') << Hash(key);
+    keyDirectory = (filesystem::path(directory) / name.str()).string();
+
+    // the key file is the last thing written, a directory without it is incomplete.
+    // Comparing the whole key guards against hash collisions
+    ifstream keyFile(filesystem::path(keyDirectory) / keyFilename);
+    const string storedKey((istreambuf_iterator<char>(keyFile)), istreambuf_iterator<char>());
+    retrieved = keyFile.is_open() && storedKey == key;
+
+    if (retrieved) {
+        G4cout << "Retrieving physics tables from " << keyDirectory << G4endl;
+        physicsList->SetPhysicsTableRetrieved(keyDirectory);
+    } else {
+        G4cout << "Physics tables not found in " << directory << ", they will be stored in " << keyDirectory
+               << G4endl;
+    }
+}
+
+void PhysicsCache::Store(G4VUserPhysicsList *physicsList) {
+    // written to a private directory and renamed, so that concurrent jobs never see a partial cache entry
+    filesystem::create_directories(directory);
+    const auto temporaryDirectory = keyDirectory + ".tmp" + to_string(getpid());
+    filesystem::remove_all(temporaryDirectory);
+    filesystem::create_directories(temporaryDirectory);
+
+    if (!physicsList->StorePhysicsTable(temporaryDirectory)) {
+        filesystem::remove_all(temporaryDirectory);
+        throw runtime_error("Could not store the physics tables in " + temporaryDirectory);
+    }
+    // a truncated key never matches, and its entry would keep later jobs from storing a complete one
+    ofstream keyFile(filesystem::path(temporaryDirectory) / keyFilename);
+    keyFile << key;
+    keyFile.close();
+    if (!keyFile) {
+        filesystem::remove_all(temporaryDirectory);
+        throw runtime_error("Could not write the key of the physics tables in " + temporaryDirectory);
+    }
+
+    error_code error;
+    filesystem::rename(temporaryDirectory, keyDirectory, error);
+    if (error) {
+        // another job stored the same key first
+        filesystem::remove_all(temporaryDirectory);
+    } else {
+        G4cout << "Physics tables stored in " << keyDirectory << G4endl;
+    }
+}
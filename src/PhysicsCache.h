@@ -0,0 +1,34 @@
+
+#pragma once
+
+#include <G4VUserPhysicsList.hh>
+
+#include <string>
+
+// Stores the physics tables built on a cache miss and retrieves them on later runs with the same key. The key
+// covers the Geant4 version, the physics preset, the production cuts of every region and the composition of
+// the materials of the stack, each distinct key has its own subdirectory. Only the tables of the physics list are
+// cached (electromagnetic processes and production cuts): the high precision neutron data and the hadronic cross
+// sections are still loaded by every run
+class PhysicsCache {
+public:
+    static void SetDirectory(const std::string& directory);
+
+    static bool IsEnabled() { return !directory.empty(); }
+
+    // called on the master after the run manager is initialized and before the tables are built
+    static void Retrieve(G4VUserPhysicsList* physicsList, const std::string& preset);
+
+    static bool IsRetrieved() { return retrieved; }
+
+    // called on the master once the tables are built, after a cache miss
+    static void Store(G4VUserPhysicsList* physicsList);
+
+private:
+    static std::string CreateKey(const std::string& preset);
+
+    static std::string directory;
+    static std::string key;
+    static std::string keyDirectory;
+    static bool retrieved;
+};
@@ -17,6 +17,7 @@
 #include <G4EmPenelopePhysics.hh>
 #include <G4HadronElasticPhysicsHP.hh>
 #include <G4IonBinaryCascadePhysics.hh>
+#include <G4HadronPhysicsQGSP_BIC.hh>
 #include <G4HadronPhysicsQGSP_BIC_HP.hh>
 #include <G4NuclideTable.hh>
 #include <G4PhysListUtil.hh>
@@ -27,17 +28,40 @@
 #include <G4LossTableManager.hh>
 #include <G4UAtomicDeexcitation.hh>
 
+#include <algorithm>
+
 using namespace std;
 using namespace CLHEP;
 
 // https://github.com/Geant4/geant4/blob/master/examples/extended/radioactivedecay/rdecay01/src/PhysicsList.cc
 
-PhysicsList::PhysicsList() : G4VModularPhysicsList() {
+double PhysicsList::meanLifeThreshold = 1 * year;
+double PhysicsList::veryLongDecayTime = 1e12 * year;
+
+const vector<string> &PhysicsList::GetPresets() {
+    static const vector<string> presets = {"full", "standard", "fast"};
+    return presets;
+}
+
+void PhysicsList::SetMeanLifeThreshold(double years) {
+    meanLifeThreshold = years * year;
+}
+
+void PhysicsList::SetVeryLongDecayTime(double years) {
+    veryLongDecayTime = years * year;
+}
+
+PhysicsList::PhysicsList(const string &preset) : G4VModularPhysicsList(), preset(preset) {
+    const auto &presets = GetPresets();
+    if (find(presets.begin(), presets.end(), preset) == presets.end()) {
+        throw runtime_error("Unknown physics preset " + preset);
+    }
+
     G4PhysListUtil::InitialiseParameters();
 
     SetVerboseLevel(1);
 
-    const G4double meanLife = 1 * year  ;
+    const G4double meanLife = meanLifeThreshold;
     G4NuclideTable::GetInstance()->SetMeanLifeThreshold(meanLife);
     G4NuclideTable::GetInstance()->SetLevelTolerance(1.0 * eV);
 
@@ -58,16 +82,33 @@ PhysicsList::PhysicsList() : G4VModularPhysicsList() {
     RegisterPhysics(new G4DecayPhysics());
     RegisterPhysics(new G4RadioactiveDecayPhysics());
     // RegisterPhysics(new G4EmExtraPhysics());
-    RegisterPhysics(new G4IonBinaryCascadePhysics());
-    RegisterPhysics(new G4HadronPhysicsQGSP_BIC_HP());
-    RegisterPhysics(new G4HadronElasticPhysicsHP());
-    RegisterPhysics(new G4IonPhysics());
 
-    // Neutron tracking cut
-    RegisterPhysics(new G4NeutronTrackingCut());
+    if (preset == "full") {
+        RegisterPhysics(new G4IonBinaryCascadePhysics());
+        RegisterPhysics(new G4HadronPhysicsQGSP_BIC_HP());
+        RegisterPhysics(new G4HadronElasticPhysicsHP());
+        RegisterPhysics(new G4IonPhysics());
+    } else if (preset == "standard") {
+        // the same models without the neutron data libraries, which dominate the initialization
+        RegisterPhysics(new G4IonBinaryCascadePhysics());
+        RegisterPhysics(new G4HadronPhysicsQGSP_BIC());
+        RegisterPhysics(new G4HadronElasticPhysics());
+    }
+
+    if (preset != "fast") {
+        // Neutron tracking cut
+        RegisterPhysics(new G4NeutronTrackingCut());
+    }
 
     // RegisterPhysics(new G4EmLivermorePhysics());
-    RegisterPhysics(new G4EmStandardPhysics_option4());
+    if (preset == "fast") {
+        RegisterPhysics(new G4EmStandardPhysics());
+    } else {
+        RegisterPhysics(new G4EmStandardPhysics_option4());
+    }
+
+    G4cout << "Physics preset " << preset << ", mean life threshold " << meanLifeThreshold / year
+           << " years, very long decay time " << veryLongDecayTime / year << " years" << G4endl;
 }
 
 void PhysicsList::ConstructProcess() {
@@ -75,7 +116,7 @@ void PhysicsList::ConstructProcess() {
 
     G4RadioactiveDecay *radioactiveDecay = new G4RadioactiveDecay();
 
-    radioactiveDecay->SetThresholdForVeryLongDecayTime(pow(10,12) * CLHEP::year);
+    radioactiveDecay->SetThresholdForVeryLongDecayTime(veryLongDecayTime);
 
     G4bool ARMflag = false;
     radioactiveDecay->SetARM(ARMflag);        //Atomic Rearangement
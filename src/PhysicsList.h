@@ -14,10 +14,35 @@
 #include <G4VModularPhysicsList.hh>
 
 
+#include <string>
+#include <vector>
+
 class PhysicsList : public G4VModularPhysicsList {
 public:
-    PhysicsList();
+    // "full": option4 EM with QGSP_BIC_HP hadrons and HP neutrons, "standard": option4 EM with QGSP_BIC hadrons
+    // and no neutron data libraries, "fast": standard EM and decays only, enough for gamma and beta emitters
+    explicit PhysicsList(const std::string& preset = "full");
 
     void ConstructProcess() override;
+
+    static const std::vector<std::string>& GetPresets();
+
+    const std::string& GetPreset() const { return preset; }
+
+    // nuclides with a shorter mean life (years) decay within the primary chain
+    static void SetMeanLifeThreshold(double years);
+
+    // decays slower than this (years) are not simulated
+    static void SetVeryLongDecayTime(double years);
+
+    static double GetMeanLifeThreshold() { return meanLifeThreshold; }
+
+    static double GetVeryLongDecayTime() { return veryLongDecayTime; }
+
+private:
+    const std::string preset;
+
+    static double meanLifeThreshold;
+    static double veryLongDecayTime;
 };
 
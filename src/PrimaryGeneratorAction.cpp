@@ -2,6 +2,13 @@
 #include "PrimaryGeneratorAction.h"
 #include "RunAction.h"
 #include "DetectorConstruction.h"
+#include "DepthSampler.h"
+#include "EventSeeding.h"
+#include "MPIRun.h"
+#include "PhaseSpace.h"
+#include "PrimarySource.h"
+#include "Spectrum.h"
+#include "StartupProfile.h"
 
 #include <G4Event.hh>
 #include <G4ParticleTable.hh>
@@ -20,37 +27,96 @@ PrimaryGeneratorAction::PrimaryGeneratorAction() : G4VUserPrimaryGeneratorAction
 }
 
 void PrimaryGeneratorAction::GeneratePrimaries(G4Event *event) {
-    const auto maxDepth = DetectorConstruction::GetThickness();
-    const double z = G4UniformRand() * maxDepth;
+    // the first thread to get here ends the phase, the lock is taken once per thread
+    static thread_local bool firstEvent = true;
+    if (firstEvent) {
+        StartupProfile::Stop("first event");
+        firstEvent = false;
+    }
 
-    gun.SetParticlePosition({0.0, 0.0, z});
+    // global index of the event, across the shards or the MPI ranks
+    uint64_t eventIndex = EventSeeding::GetEventOffset() + event->GetEventID();
+    if (MPIRun::IsEnabled()) {
+        const auto next = MPIRun::NextEvent();
+        if (next < 0) {
+            // every block of the job has been handed out
+            event->SetEventAborted();
+            RunAction::RequestAbort();
+            return;
+        }
+        eventIndex = next;
+    }
+    RunAction::SetEventIndex(eventIndex);
 
-    RunAction::SetDepth(maxDepth - z);
+    if (EventSeeding::IsEnabled()) {
+        EventSeeding::SeedEvent(eventIndex);
+    }
 
-    if (!foundPrimaryParticle) {
-        gun.SetParticleDefinition(FindPrimaryParticle());
-        foundPrimaryParticle = true;
+    if (PhaseSpaceReader::IsEnabled()) {
+        GenerateFromPhaseSpace(event, eventIndex);
+        return;
     }
 
-    gun.GeneratePrimaryVertex(event);
+    const auto maxDepth = DetectorConstruction::GetThickness();
+
+    // particle definitions are resolved once by the master
+    const auto particle = PrimarySource::Sample(G4UniformRand());
+    gun.SetParticleDefinition(PrimarySource::GetParticle(particle).definition);
 
-    RunAction::IncreaseLaunchedPrimaries(gun.GetParticleDefinition()->GetParticleName());
+    if (Spectrum::IsLoaded()) {
+        // surface source on the upstream face of the stack
+        double energy;
+        G4ThreeVector direction;
+        Spectrum::Sample(G4UniformRand(), G4UniformRand(), G4UniformRand(), G4UniformRand(), energy, direction);
+        gun.SetParticleEnergy(energy);
+        gun.SetParticleMomentumDirection(direction);
+        gun.SetParticlePosition({0.0, 0.0, 0.0});
+        RunAction::SetDepth(maxDepth);
+        gun.GeneratePrimaryVertex(event);
+    } else {
+        // decays at rest, uniformly distributed in depth unless biased towards the detector
+        double depth, weight;
+        DepthSampler::Sample(G4UniformRand(), G4UniformRand(), depth, weight);
+        gun.SetParticlePosition({0.0, 0.0, maxDepth - depth});
+        RunAction::SetDepth(depth);
+        gun.GeneratePrimaryVertex(event);
+        // inherited by every secondary and carried into the scoring
+        event->GetPrimaryVertex()->SetWeight(weight);
+    }
+
+    RunAction::IncreaseLaunchedPrimaries(particle);
 }
 
-G4ParticleDefinition *PrimaryGeneratorAction::FindPrimaryParticle() {
-
-    string inputParticleName = RunAction::GetParticleName();
-    for (int Z = 1; Z <= 110; Z++) {
-        for (int A = 2 * Z - 1; A <= 3 * Z; A++) {
-            auto particle = G4IonTable::GetIonTable()->GetIon(Z, A);
-            if (!particle) {
-                continue;
-            }
-            if (particle->GetParticleName() == inputParticleName) {
-                return particle;
-            }
+void PrimaryGeneratorAction::GenerateFromPhaseSpace(G4Event *event, uint64_t eventIndex) {
+    // records follow the global event index, whichever thread or process runs the event
+    const auto record = PhaseSpaceReader::Get(eventIndex);
+    if (record == nullptr) {
+        // every record has been replayed
+        event->SetEventAborted();
+        RunAction::RequestAbort();
+        return;
+    }
+
+    auto &particle = phaseSpaceParticles[record->pdg];
+    if (particle == nullptr) {
+        particle = G4ParticleTable::GetParticleTable()->FindParticle(record->pdg);
+        if (particle == nullptr) {
+            particle = G4IonTable::GetIonTable()->GetIon(record->pdg);
+        }
+        if (particle == nullptr) {
+            throw runtime_error("Unknown particle in phase-space file with PDG code " + to_string(record->pdg));
         }
     }
 
-    throw invalid_argument("Particle not found in the ion table");
+    gun.SetParticleDefinition(particle);
+    gun.SetParticleEnergy(record->energy * MeV);
+    gun.SetParticlePosition({record->x * mm, record->y * mm, 0.0});
+    gun.SetParticleMomentumDirection({record->directionX, record->directionY, record->directionZ});
+    gun.GeneratePrimaryVertex(event);
+    event->GetPrimaryVertex()->SetWeight(record->weight);
+
+    // the distance to the detector now includes the stack the phase-space was produced in
+    RunAction::SetDepth(record->depth * mm + DetectorConstruction::GetThickness());
+
+    RunAction::IncreaseLaunchedPrimaries();
 }
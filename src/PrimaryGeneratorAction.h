@@ -5,6 +5,8 @@
 #include <G4ParticleGun.hh>
 #include <G4VUserPrimaryGeneratorAction.hh>
 
+#include <map>
+
 class PrimaryGeneratorAction : public G4VUserPrimaryGeneratorAction {
 public:
     PrimaryGeneratorAction();
@@ -15,9 +17,10 @@ public:
 private:
     G4ParticleGun gun;
 
-    bool foundPrimaryParticle = false;
+    // launches the next record of the phase-space file from the upstream face of the stack
+    void GenerateFromPhaseSpace(G4Event *, uint64_t eventIndex);
 
-    static G4ParticleDefinition *FindPrimaryParticle();
+    std::map<int, G4ParticleDefinition *> phaseSpaceParticles;
 };
 
 
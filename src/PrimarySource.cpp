@@ -0,0 +1,78 @@
+
+#include "PrimarySource.h"
+
+#include <G4IonTable.hh>
+#include <G4NistManager.hh>
+#include <G4ParticleTable.hh>
+#include <G4SystemOfUnits.hh>
+
+#include <regex>
+
+using namespace std;
+using namespace CLHEP;
+
+vector<PrimarySource::Particle> PrimarySource::particles;
+AliasTable PrimarySource::table;
+
+void PrimarySource::SetParticles(const vector<string> &specifications) {
+    particles.clear();
+    for (const auto &specification: specifications) {
+        Particle particle;
+        const auto separator = specification.rfind(':');
+        particle.name = specification.substr(0, separator);
+        if (separator != string::npos) {
+            try {
+                particle.activity = stod(specification.substr(separator + 1));
+            } catch (const exception &) {
+                throw runtime_error("Invalid particle '" + specification + "', expected 'NAME' or 'NAME:ACTIVITY'");
+            }
+            if (!(particle.activity > 0)) {
+                throw runtime_error("Activity of " + particle.name + " must be positive");
+            }
+        }
+        particles.push_back(particle);
+    }
+}
+
+void PrimarySource::Initialize(bool spectrum) {
+    vector<double> activities;
+    for (auto &particle: particles) {
+        particle.definition = FindParticle(particle.name);
+        if (!spectrum && !particle.definition->IsGeneralIon()) {
+            throw runtime_error("Particle " + particle.name + " needs an input spectrum (-i)");
+        }
+        activities.push_back(particle.activity);
+    }
+    table = AliasTable(activities);
+
+    if (particles.size() > 1) {
+        for (const auto &particle: particles) {
+            G4cout << "Source " << particle.definition->GetParticleName() << ": "
+                   << 100 * particle.activity / table.GetTotal() << "% of the activity" << G4endl;
+        }
+    }
+}
+
+G4ParticleDefinition *PrimarySource::FindParticle(const string &name) {
+    auto particle = G4ParticleTable::GetParticleTable()->FindParticle(name);
+    if (particle != nullptr) {
+        return particle;
+    }
+
+    // ions are only in the particle table once they have been created, build them from the element symbol,
+    // mass number and excitation energy
+    static const regex ionName(R"(([A-Z][a-z]?)(\d+)(?:\[(\d+(?:\.\d*)?)\])?)");
+    smatch match;
+    if (regex_match(name, match, ionName)) {
+        const auto Z = G4NistManager::Instance()->GetZ(match[1].str());
+        const auto A = stoi(match[2].str());
+        const auto excitation = match[3].matched ? stod(match[3].str()) * keV : 0.0;
+        if (Z > 0 && A >= Z) {
+            particle = G4IonTable::GetIonTable()->GetIon(Z, A, excitation);
+        }
+    }
+    if (particle == nullptr) {
+        throw runtime_error("Particle " + name + " not found");
+    }
+    return particle;
+}
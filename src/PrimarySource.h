@@ -0,0 +1,42 @@
+
+#pragma once
+
+#include "AliasTable.h"
+
+#include <G4ParticleDefinition.hh>
+
+#include <string>
+#include <vector>
+
+// Particles launched as primaries: a single particle or a mixture of isotopes decaying together, each one drawn
+// with a probability proportional to its activity
+class PrimarySource {
+public:
+    struct Particle {
+        std::string name;
+        double activity = 1;
+        G4ParticleDefinition* definition = nullptr;
+    };
+
+    // "NAME" or "NAME:ACTIVITY", e.g. {"Cs137:1000", "Am241[59.541]:50"}
+    static void SetParticles(const std::vector<std::string>& specifications);
+
+    // resolves the particle definitions, called by the master once the physics is built
+    static void Initialize(bool spectrum);
+
+    static size_t GetNumberOfParticles() { return particles.size(); }
+
+    static const Particle& GetParticle(size_t i) { return particles[i]; }
+
+    static double GetTotalActivity() { return table.GetTotal(); }
+
+    // u uniform in [0, 1)
+    static int Sample(double u) { return particles.size() == 1 ? 0 : table.Sample(u); }
+
+    // "alpha", "Cs137" or "Am241[59.541]" (excitation energy in keV)
+    static G4ParticleDefinition* FindParticle(const std::string& name);
+
+private:
+    static std::vector<Particle> particles;
+    static AliasTable table;
+};
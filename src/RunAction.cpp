@@ -1,290 +1,426 @@
 
+#include "Convergence.h"
 #include "RunAction.h"
 #include "DetectorConstruction.h"
+#include "DepthSampler.h"
+#include "MPIRun.h"
+#include "PhaseSpace.h"
+#include "PrimarySource.h"
+#include "SecondaryWriter.h"
+#include "ShardMerger.h"
+#include "Spectrum.h"
+#include "SpeciesRegistry.h"
+#include "StartupProfile.h"
+
+#include <G4RunManagerFactory.hh>
+#include <G4Threading.hh>
 
 #include <iostream>
-#include <TMath.h>
-#include <TSystem.h>
 #include <filesystem>
-#include <numeric>
 
 using namespace std;
 using namespace CLHEP;
 
+int RunAction::shardIndex = 0;
+int RunAction::shardCount = 0;
 int RunAction::requestedPrimaries = 0;
 int RunAction::requestedSecondaries = 0;
 double thread_local RunAction::depth = 0;
+uint64_t thread_local RunAction::eventIndex = 0;
 
-map<string, double> RunAction::launchedPrimariesMap = {};
+RunAction::Counters RunAction::masterCounters;
+RunAction::Counters RunAction::resumedCounters;
+vector<atomic<RunAction::Counters *>> RunAction::workerCounters;
+vector<unique_ptr<RunAction::Counters>> RunAction::ownedWorkerCounters;
+thread_local RunAction::Counters *RunAction::threadCounters = &RunAction::masterCounters;
+atomic<bool> RunAction::abortRequested = false;
 
-mutex RunAction::inputMutex;
 mutex RunAction::outputMutex;
 
-string RunAction::inputParticleName;
 string RunAction::outputFilename;
 
 TFile *RunAction::outputFile = nullptr;
 
-TH1D *RunAction::electronsMinusEnergy = nullptr;
-TH1D *RunAction::electronsPlusEnergy = nullptr;
-TH1D *RunAction::gammasEnergy = nullptr;
-TH1D *RunAction::alphasEnergy = nullptr;
-TH1D *RunAction::neutronsEnergy = nullptr;
-
-TH1D *RunAction::electronsMinusZenith = nullptr;
-TH1D *RunAction::electronsPlusZenith = nullptr;
-TH1D *RunAction::gammasZenith = nullptr;
-TH1D *RunAction::alphasZenith = nullptr;
-TH1D *RunAction::neutronsZenith = nullptr;
-
-TH2D *RunAction::electronsMinusEnergyZenith = nullptr;
-TH2D *RunAction::electronsPlusEnergyZenith = nullptr;
-TH2D *RunAction::gammasEnergyZenith = nullptr;
-TH2D *RunAction::alphasEnergyZenith = nullptr;
-TH2D *RunAction::neutronsEnergyZenith = nullptr;
-
-TH1D* RunAction::electronsMinusDepht = nullptr;
-TH1D* RunAction::electronsPlusDepht = nullptr;
-TH1D* RunAction::gammasDepht = nullptr;
-TH1D* RunAction::alphasDepht = nullptr;
-TH1D* RunAction::neutronsDepht = nullptr;
-
-const unsigned int binsEnergyN = 1000;
-const double binsEnergyMin = 0;
-const double binsEnergyMax = 10;
-const double energyWidth = (binsEnergyMax - binsEnergyMin) / binsEnergyN;
+RunAction::Histograms RunAction::mergedHistograms;
+thread_local RunAction::Histograms *RunAction::threadHistograms = nullptr;
+vector<unsigned long long> RunAction::mergedLaunchedPerParticle;
+thread_local vector<unsigned long long> *RunAction::threadLaunchedPerParticle = nullptr;
+thread_local vector<RunAction::HitBuffer> RunAction::hitBuffers;
+vector<RunAction *> RunAction::workers;
+
+map<string, Axis> RunAction::binningOverrides;
+vector<Binning> RunAction::binnings;
+
+const Axis defaultEnergyAxis(Axis::Scale::Linear, 1000, 0, 10);
+const Axis defaultZenithAxis(Axis::Scale::Linear, 100, 0, 90);
+const unsigned int binsDepthN = 500;
+const double binsDepthMax = 1000;
 
 RunAction::RunAction() : G4UserRunAction() {}
 
 void RunAction::BeginOfRunAction(const G4Run *) {
-    lock_guard<std::mutex> lock(mutex);
-
     if (IsMaster()) {
+        StartupProfile::Stop("run initialization");
+
         if (outputFile != nullptr) {
             outputFile->Close();
             delete outputFile;
         }
 
-        outputFile = new TFile(outputFilename.c_str(), "RECREATE");
-
-        /*
-        const unsigned int binsEnergyN = 5000;
-        const double binsEnergyMin = 1E-4;
-        const double binsEnergyMax = 1E2;
-        
-        double binsEnergy[binsEnergyN + 1];
-        for (int i = 0; i <= binsEnergyN; ++i) {
-            binsEnergy[i] = TMath::Power(10, (TMath::Log10(binsEnergyMin) +
-                                              i * (TMath::Log10(binsEnergyMax) - TMath::Log10(binsEnergyMin)) /
-                                              binsEnergyN));
+        // the results of every rank are reduced to rank 0, which alone writes them
+        if (MPIRun::GetRank() == 0) {
+            outputFile = new TFile(outputFilename.c_str(), "RECREATE");
+        }
+
+        // particle definitions are shared by all threads, resolve them once before the workers start
+        SpeciesRegistry::Initialize();
+        if (PrimarySource::GetNumberOfParticles() > 0) {
+            PrimarySource::Initialize(Spectrum::IsLoaded());
+        }
+        DepthSampler::Initialize(DetectorConstruction::GetThickness());
+        Culling::Initialize();
+        if (Convergence::IsEnabled()) {
+            Convergence::Initialize();
+        }
+        CreateBinnings();
+
+        if (SecondaryWriter::IsEnabled()) {
+            SecondaryWriter::Start();
+        }
+        if (PhaseSpaceWriter::IsEnabled()) {
+            PhaseSpaceWriter::Open();
+        }
+
+        mergedHistograms.clear();
+        for (const auto &binning: binnings) {
+            mergedHistograms.emplace_back(binning);
         }
-        */
 
-        double binsEnergy[binsEnergyN + 1];
-        for (int i = 0; i <= binsEnergyN; ++i) {
-            binsEnergy[i] = binsEnergyMin + i * (binsEnergyMax - binsEnergyMin) / binsEnergyN;
+        // the workers only start their run after this, new ones allocate zeroed counters
+        auto resetCounters = [](Counters &counter) {
+            counter.launchedPrimaries = 0;
+            counter.secondaries = 0;
+            for (auto &count: counter.culled) {
+                count = 0;
+            }
+        };
+        resetCounters(masterCounters);
+        for (auto &slot: workerCounters) {
+            if (const auto counter = slot.load(memory_order_acquire)) {
+                resetCounters(*counter);
+            }
         }
+        abortRequested = false;
+
+        const auto &resumed = Checkpoint::GetResumedTotals();
+        resumedCounters.launchedPrimaries = resumed.launchedPrimaries;
+        resumedCounters.secondaries = resumed.secondaries;
+        for (int reason = 0; reason < Culling::NumberOfReasons; ++reason) {
+            resumedCounters.culled[reason] = resumed.culled[reason];
+        }
+        if (Checkpoint::IsEnabled() || Checkpoint::IsResumed()) {
+            Checkpoint::Start(binnings);
+        }
+
+        mergedLaunchedPerParticle.assign(PrimarySource::GetNumberOfParticles(), 0);
 
-        const unsigned int binsZenithN = 100;
-        const double binsZenithMin = 0;
-        const double binsZenithMax = 90;
-
-        const unsigned int binsDepthN = 500;
-        const double binsDepthMin = 0;
-        const double binsDepthMax = 1000;
-
-        electronsMinusEnergy = new TH1D("electron_minus_energy", "Electron (e-) Kinetic Energy (MeV)", binsEnergyN,
-                                        binsEnergy);
-        electronsMinusEnergy->GetXaxis()->SetTitle("Energy (MeV)");
-        electronsMinusEnergy->GetYaxis()->SetTitle("Hz / MeV / (Bq / mm)");
-
-        electronsPlusEnergy = new TH1D("electron_plus_energy", "Electron (e+) Kinetic Energy (MeV)", binsEnergyN,
-                                       binsEnergy);
-        electronsPlusEnergy->GetXaxis()->SetTitle("Energy (MeV)");
-        electronsPlusEnergy->GetYaxis()->SetTitle("Hz / MeV / (Bq / mm)");
-
-        gammasEnergy = new TH1D("gamma_energy", "Gamma Kinetic Energy (MeV)", binsEnergyN, binsEnergy);
-        gammasEnergy->GetXaxis()->SetTitle("Energy (MeV)");
-        gammasEnergy->GetYaxis()->SetTitle("Hz / MeV / (Bq / mm)");
-
-        alphasEnergy = new TH1D("alpha_energy", "Alpha Kinetic Energy (MeV)", binsEnergyN, binsEnergy);
-        alphasEnergy->GetXaxis()->SetTitle("Energy (MeV)");
-        alphasEnergy->GetYaxis()->SetTitle("Hz / MeV / (Bq / mm)");
-
-        neutronsEnergy = new TH1D("neutron_energy", "Neutron Kinetic Energy (MeV)", binsEnergyN, binsEnergy);
-        neutronsEnergy->GetXaxis()->SetTitle("Energy (MeV)");
-        neutronsEnergy->GetYaxis()->SetTitle("Hz / MeV / (Bq / mm)");
-
-        electronsMinusZenith = new TH1D("electron_minus_zenith", "Electron (e-) Zenith Angle (degrees)", binsZenithN,
-                                        binsZenithMin,
-                                        binsZenithMax);
-        electronsMinusZenith->GetXaxis()->SetTitle("Zenith Angle (degrees)");
-        electronsMinusZenith->GetYaxis()->SetTitle("Counts");
-
-        electronsPlusZenith = new TH1D("electron_plus_zenith", "Electron (e+) Zenith Angle (degrees)", binsZenithN,
-                                       binsZenithMin,
-                                       binsZenithMax);
-        electronsPlusZenith->GetXaxis()->SetTitle("Zenith Angle (degrees)");
-        electronsPlusZenith->GetYaxis()->SetTitle("Counts");
-
-        gammasZenith = new TH1D("gamma_zenith", "Gamma Zenith Angle (degrees)", binsZenithN, binsZenithMin,
-                                binsZenithMax);
-        gammasZenith->GetXaxis()->SetTitle("Zenith Angle (degrees)");
-        gammasZenith->GetYaxis()->SetTitle("Counts");
-
-        alphasZenith = new TH1D("alpha_zenith", "Alpha Zenith Angle (degrees)", binsZenithN, binsZenithMin,
-                                binsZenithMax);
-        alphasZenith->GetXaxis()->SetTitle("Zenith Angle (degrees)");
-        alphasZenith->GetYaxis()->SetTitle("Counts");
-
-        neutronsZenith = new TH1D("neutron_zenith", "Neutron Zenith Angle (degrees)", binsZenithN, binsZenithMin,
-                                  binsZenithMax);
-        neutronsZenith->GetXaxis()->SetTitle("Zenith Angle (degrees)");
-        neutronsZenith->GetYaxis()->SetTitle("Counts");
-
-        electronsMinusEnergyZenith = new TH2D("electron_minus_energy_zenith",
-                                              "Electron (e-) Kinetic Energy (MeV) vs Zenith Angle (degrees)",
-                                              binsEnergyN,
-                                              binsEnergy, binsZenithN, binsZenithMin, binsZenithMax);
-        electronsMinusEnergyZenith->GetXaxis()->SetTitle("Energy (MeV)");
-        electronsMinusEnergyZenith->GetYaxis()->SetTitle("Zenith Angle (degrees)");
-        electronsMinusEnergyZenith->GetZaxis()->SetTitle("Counts");
-
-        electronsPlusEnergyZenith = new TH2D("electron_plus_energy_zenith",
-                                             "Electron (e+) Kinetic Energy (MeV) vs Zenith Angle (degrees)",
-                                             binsEnergyN,
-                                             binsEnergy, binsZenithN, binsZenithMin, binsZenithMax);
-        electronsPlusEnergyZenith->GetXaxis()->SetTitle("Energy (MeV)");
-        electronsPlusEnergyZenith->GetYaxis()->SetTitle("Zenith Angle (degrees)");
-        electronsPlusEnergyZenith->GetZaxis()->SetTitle("Counts");
-
-        gammasEnergyZenith = new TH2D("gamma_energy_zenith", "Gamma Kinetic Energy (MeV) vs Zenith Angle (degrees)",
-                                      binsEnergyN,
-                                      binsEnergy,
-                                      binsZenithN, binsZenithMin, binsZenithMax);
-        gammasEnergyZenith->GetXaxis()->SetTitle("Energy (MeV)");
-        gammasEnergyZenith->GetYaxis()->SetTitle("Zenith Angle (degrees)");
-        gammasEnergyZenith->GetZaxis()->SetTitle("Counts");
-
-        alphasEnergyZenith = new TH2D("alpha_energy_zenith", "Alpha Kinetic Energy (MeV) vs Zenith Angle (degrees)",
-                                      binsEnergyN,
-                                      binsEnergy,
-                                      binsZenithN, binsZenithMin, binsZenithMax);
-        alphasEnergyZenith->GetXaxis()->SetTitle("Energy (MeV)");
-        alphasEnergyZenith->GetYaxis()->SetTitle("Zenith Angle (degrees)");
-        alphasEnergyZenith->GetZaxis()->SetTitle("Counts");
-
-        neutronsEnergyZenith = new TH2D("neutron_energy_zenith",
-                                        "Neutron Kinetic Energy (MeV) vs Zenith Angle (degrees)", binsEnergyN,
-                                        binsEnergy, binsZenithN, binsZenithMin, binsZenithMax);
-        neutronsEnergyZenith->GetXaxis()->SetTitle("Energy (MeV)");
-        neutronsEnergyZenith->GetYaxis()->SetTitle("Zenith Angle (degrees)");
-        neutronsEnergyZenith->GetZaxis()->SetTitle("Counts");
-
-        electronsMinusDepht = new TH1D("electron_minus_depth", "Electron (e-) Depth (mm)", binsDepthN, binsDepthMin,
-                                       binsDepthMax);
-        electronsPlusDepht = new TH1D("electron_plus_depth", "Electron (e+) Depth (mm)", binsDepthN, binsDepthMin,
-                                       binsDepthMax);
-        gammasDepht = new TH1D("gamma_depth", "Gamma Depth (mm)", binsDepthN, binsDepthMin, binsDepthMax);
-        alphasDepht = new TH1D("alpha_depth", "Alpha Depth (mm)", binsDepthN, binsDepthMin, binsDepthMax);
-        neutronsDepht = new TH1D("neutron_depth", "Neutron Depth (mm)", binsDepthN, binsDepthMin, binsDepthMax);
+        if (!G4Threading::IsMultithreadedApplication()) {
+            threadHistograms = &mergedHistograms;
+            threadLaunchedPerParticle = &mergedLaunchedPerParticle;
+            threadCounters = &masterCounters;
+            Checkpoint::BeginOfThread();
+        }
+
+        if (MPIRun::IsEnabled()) {
+            MPIRun::Start();
+        }
+
+        // workers build their own processes before their first event
+        StartupProfile::Start("first event");
+    } else {
+        // allocated by the worker thread itself
+        histograms.clear();
+        for (const auto &binning: binnings) {
+            histograms.emplace_back(binning);
+        }
+        threadHistograms = &histograms;
+        launchedPerParticle.assign(PrimarySource::GetNumberOfParticles(), 0);
+        threadLaunchedPerParticle = &launchedPerParticle;
+        Checkpoint::BeginOfThread();
+
+        lock_guard<std::mutex> lock(outputMutex);
+        auto &slot = workerCounters.at(G4Threading::G4GetThreadId());
+        if (slot.load(memory_order_relaxed) == nullptr) {
+            ownedWorkerCounters.push_back(make_unique<Counters>());
+            slot.store(ownedWorkerCounters.back().get(), memory_order_release);
+        }
+        threadCounters = slot.load(memory_order_relaxed);
+        workers.push_back(this);
     }
 }
 
 void RunAction::EndOfRunAction(const G4Run *) {
+    if (SecondaryWriter::IsEnabled()) {
+        SecondaryWriter::Flush();
+    }
+    if (PhaseSpaceWriter::IsEnabled()) {
+        PhaseSpaceWriter::Flush();
+    }
+    // the master runs the events itself unless multithreaded
+    if (!isMaster || !G4Threading::IsMultithreadedApplication()) {
+        Checkpoint::EndOfThread();
+    }
+
     if (!isMaster) { return; }
 
-    lock_guard<std::mutex> lockInput(inputMutex);
-    lock_guard<std::mutex> lockOutput(outputMutex);
+    // the workers have handed over their last buffers, wait until everything is written
+    if (SecondaryWriter::IsEnabled()) {
+        SecondaryWriter::Stop();
+    }
+    if (PhaseSpaceWriter::IsEnabled()) {
+        PhaseSpaceWriter::Close(GetEquivalentPrimaries(), GetSourceThickness(), IsSurfaceSource());
+    }
+
+    lock_guard<std::mutex> lock(outputMutex);
 
-    const auto launchedParticles = GetLaunchedPrimaries(false);
-    const auto detectorThickness = DetectorConstruction::GetThickness();
+    // workers have finished their event loop by the time the master ends the run
+    for (const auto worker: workers) {
+        for (size_t i = 0; i < mergedHistograms.size(); ++i) {
+            mergedHistograms[i].Add(worker->histograms[i]);
+        }
+        for (size_t i = 0; i < mergedLaunchedPerParticle.size(); ++i) {
+            mergedLaunchedPerParticle[i] += worker->launchedPerParticle[i];
+        }
+    }
+    workers.clear();
 
-    const auto scale = 1.0 * detectorThickness / launchedParticles / energyWidth;
-    // print the scale with many decimal places
-    G4cout << "Scale factor: " << scale << G4endl;
+    const auto &resumed = Checkpoint::GetResumedTotals();
+    for (size_t i = 0; i < resumed.launchedPerParticle.size(); ++i) {
+        mergedLaunchedPerParticle[i] += resumed.launchedPerParticle[i];
+    }
 
-    electronsMinusEnergy->Scale(scale);
-    electronsPlusEnergy->Scale(scale);
-    gammasEnergy->Scale(scale);
-    alphasEnergy->Scale(scale);
-    neutronsEnergy->Scale(scale);
+    if (MPIRun::IsEnabled()) {
+        MPIRun::Finish();
+        ReduceCounters();
+    }
 
-    electronsMinusZenith->Scale(scale);
-    electronsPlusZenith->Scale(scale);
-    gammasZenith->Scale(scale);
-    alphasZenith->Scale(scale);
-    neutronsZenith->Scale(scale);
+    for (int reason = 0; reason < Culling::NumberOfReasons; ++reason) {
+        if (const auto count = GetCulledCount(reason); count > 0) {
+            G4cout << "Tracks culled (" << Culling::GetReasonName(reason) << "): " << count << G4endl;
+        }
+    }
 
-    electronsMinusEnergyZenith->Scale(scale);
-    electronsPlusEnergyZenith->Scale(scale);
-    gammasEnergyZenith->Scale(scale);
-    alphasEnergyZenith->Scale(scale);
-    neutronsEnergyZenith->Scale(scale);
+    if (Convergence::IsEnabled()) {
+        Convergence::PrintSummary();
+    }
 
-    electronsMinusDepht->Scale(scale);
-    electronsPlusDepht->Scale(scale);
-    gammasDepht->Scale(scale);
-    alphasDepht->Scale(scale);
-    neutronsDepht->Scale(scale);
+    const auto scale = (IsSurfaceSource() ? 1.0 : GetSourceThickness()) / GetEquivalentPrimaries();
+    if (!IsShard() && outputFile != nullptr) {
+        // print the scale with many decimal places
+        G4cout << "Scale factor: " << scale << G4endl;
+    }
 
     if (outputFile != nullptr) {
-        outputFile->Write();
-        outputFile->Close();
-        delete outputFile;
-        outputFile = nullptr;
+        outputFile->cd();
     }
-}
 
-void RunAction::InsertTrack(const G4Track *track) {
-    lock_guard<std::mutex> lock(outputMutex);
+    // histograms created while the output file is the current directory are owned and written by it
+    for (size_t i = 0; i < mergedHistograms.size(); ++i) {
+        const auto &species = SpeciesRegistry::GetSpecies(i);
+        const auto histograms = mergedHistograms[i].CreateROOTHistograms(species.name, species.label);
+        if (MPIRun::IsEnabled()) {
+            for (const auto histogram: {(TH1 *) histograms.energy, (TH1 *) histograms.zenith,
+                                        (TH1 *) histograms.energyZenith, (TH1 *) histograms.depth}) {
+                MPIRun::Reduce(histogram);
+                if (MPIRun::GetRank() != 0) {
+                    delete histogram;
+                }
+            }
+            if (MPIRun::GetRank() != 0) {
+                continue;
+            }
+        }
+        for (const auto histogram: {(TH1 *) histograms.energy, (TH1 *) histograms.zenith,
+                                    (TH1 *) histograms.energyZenith, (TH1 *) histograms.depth}) {
+            Checkpoint::AddResumed(histogram);
+        }
+        if (IsSurfaceSource()) {
+            histograms.energy->GetYaxis()->SetTitle("1 / MeV / primary");
+        }
+        // shards are normalized once merged
+        if (!IsShard()) {
+            SpeciesHistograms::Normalize(histograms, scale);
+        }
+    }
 
-    auto *particle = const_cast<G4ParticleDefinition *>(track->GetParticleDefinition());
-    const G4String particleName = particle->GetParticleName();
-    // Energy in MeV
-    const G4double kineticEnergy = track->GetKineticEnergy() / MeV;
-    const G4double zenith =
-            TMath::ACos(track->GetMomentumDirection().z()) * TMath::RadToDeg();
-    const auto depth = RunAction::depth;
-
-    if (particleName == "e-") {
-        electronsMinusEnergy->Fill(kineticEnergy);
-        electronsMinusZenith->Fill(zenith);
-        electronsMinusEnergyZenith->Fill(kineticEnergy, zenith);
-        electronsMinusDepht->Fill(depth);
-    } else if (particleName == "e+") {
-        electronsPlusEnergy->Fill(kineticEnergy);
-        electronsPlusZenith->Fill(zenith);
-        electronsPlusEnergyZenith->Fill(kineticEnergy, zenith);
-        electronsPlusDepht->Fill(depth);
-    } else if (particleName == "gamma") {
-        gammasEnergy->Fill(kineticEnergy);
-        gammasZenith->Fill(zenith);
-        gammasEnergyZenith->Fill(kineticEnergy, zenith);
-        gammasDepht->Fill(depth);
-        // G4cout << "Gamma: " << kineticEnergy << " MeV, Zenith: " << zenith << " degrees, Depth: " << depth << " cm" << G4endl;
-    } else if (particleName == "neutron") {
-        neutronsEnergy->Fill(kineticEnergy);
-        neutronsZenith->Fill(zenith);
-        neutronsEnergyZenith->Fill(kineticEnergy, zenith);
-        neutronsDepht->Fill(depth);
-    } else if (particleName == "alpha") {
-        alphasEnergy->Fill(kineticEnergy);
-        alphasZenith->Fill(zenith);
-        alphasEnergyZenith->Fill(kineticEnergy, zenith);
-        alphasDepht->Fill(depth);
-    } else {
-        // G4cout << "Unknown particle: " << particleName << G4endl;
+    if (outputFile == nullptr) {
         return;
     }
 
-    if (requestedSecondaries > 0 && GetSecondariesCount(false) >= requestedSecondaries) {
-        G4RunManager::GetRunManager()->AbortRun(true);
+    if (IsShard()) {
+        ShardMerger::WriteMetadata(GetEquivalentPrimaries(), GetSourceThickness(), IsSurfaceSource(), shardIndex,
+                                   shardCount);
+    }
+
+    if (PrimarySource::GetNumberOfParticles() > 0) {
+        WriteSourceSummary(mergedLaunchedPerParticle);
+        for (size_t i = 0; i < mergedLaunchedPerParticle.size(); ++i) {
+            G4cout << "Launched " << PrimarySource::GetParticle(i).definition->GetParticleName() << ": "
+                   << mergedLaunchedPerParticle[i] << G4endl;
+        }
+    }
+
+    outputFile->Write();
+    outputFile->Close();
+    delete outputFile;
+    outputFile = nullptr;
+}
+
+void RunAction::SetBinning(const vector<string> &specifications) {
+    for (const auto &specification: specifications) {
+        const auto separator = specification.find('=');
+        if (separator == string::npos) {
+            throw runtime_error("Invalid binning '" + specification + "', expected '[SPECIES/]AXIS=SCALE:N:MIN:MAX'");
+        }
+        const auto key = specification.substr(0, separator);
+        const auto axisName = key.substr(key.find('/') + 1);
+        if (axisName != "energy" && axisName != "zenith" && axisName != "depth") {
+            throw runtime_error("Invalid binning '" + specification + "', axis must be 'energy', 'zenith' or 'depth'");
+        }
+        binningOverrides.insert_or_assign(key, Axis::Parse(specification.substr(separator + 1)));
+    }
+}
+
+void RunAction::CreateBinnings() {
+    for (const auto &[key, axis]: binningOverrides) {
+        const auto separator = key.find('/');
+        if (separator == string::npos) {
+            continue;
+        }
+        const auto particleName = key.substr(0, separator);
+        bool scored = false;
+        for (size_t i = 0; i < SpeciesRegistry::GetNumberOfSpecies(); ++i) {
+            scored = scored || SpeciesRegistry::GetSpecies(i).particleName == particleName;
+        }
+        if (!scored) {
+            throw runtime_error("Binning given for species " + particleName + ", which is not scored");
+        }
+    }
+
+    // the default depth axis covers the whole stack, including the one a replayed phase-space was produced in
+    auto maxDepth = DetectorConstruction::GetThickness();
+    if (PhaseSpaceReader::IsEnabled()) {
+        maxDepth += GetSourceThickness();
+    }
+    const Axis defaultDepthAxis(Axis::Scale::Linear, binsDepthN, 0, std::max(binsDepthMax, maxDepth / mm));
+
+    // species specific binning first, then the one given for all species
+    const auto getAxis = [](const string &particleName, const string &axisName, const Axis &defaultAxis) {
+        auto it = binningOverrides.find(particleName + "/" + axisName);
+        if (it == binningOverrides.end()) {
+            it = binningOverrides.find(axisName);
+        }
+        return it == binningOverrides.end() ? defaultAxis : it->second;
+    };
+
+    binnings.clear();
+    for (size_t i = 0; i < SpeciesRegistry::GetNumberOfSpecies(); ++i) {
+        const auto &particleName = SpeciesRegistry::GetSpecies(i).particleName;
+        binnings.emplace_back(getAxis(particleName, "energy", defaultEnergyAxis),
+                              getAxis(particleName, "zenith", defaultZenithAxis),
+                              getAxis(particleName, "depth", defaultDepthAxis));
+
+        const auto &binning = binnings.back();
+        G4cout << "Binning of " << particleName << ": energy " << binning.energy.ToString() << ", zenith "
+               << binning.zenith.ToString() << ", depth " << binning.depth.ToString() << G4endl;
+    }
+}
+
+void RunAction::InsertHits(const SecondaryHitsCollection &hits) {
+    hitBuffers.resize(SpeciesRegistry::GetNumberOfSpecies());
+    for (auto &[energy, cosZenith, depth, weight]: hitBuffers) {
+        energy.clear();
+        cosZenith.clear();
+        depth.clear();
+        weight.clear();
+    }
+
+    const auto n = hits.entries();
+    for (size_t i = 0; i < n; ++i) {
+        const auto hit = hits[i];
+        auto &[energy, cosZenith, depth, weight] = hitBuffers[hit->species];
+        energy.push_back(hit->energy);
+        cosZenith.push_back(hit->direction.z());
+        depth.push_back(hit->depth);
+        weight.push_back(hit->weight);
+    }
+
+    auto &histograms = *threadHistograms;
+    for (size_t species = 0; species < hitBuffers.size(); ++species) {
+        const auto &[energy, cosZenith, depth, weight] = hitBuffers[species];
+        if (!energy.empty()) {
+            histograms[species].Fill(energy.data(), cosZenith.data(), depth.data(), weight.data(), energy.size());
+        }
     }
+
+    auto &secondaries = threadCounters->secondaries;
+    secondaries.store(secondaries.load(memory_order_relaxed) + n, memory_order_relaxed);
 }
 
-void RunAction::SetInputParticle(const string &particleName) {
-    inputParticleName = particleName;
+void RunAction::WriteSourceSummary(const vector<unsigned long long> &launched) {
+    // histograms are normalized per unit of total activity, the launched primaries of each particle
+    // allow rescaling them to the activity of any single one
+    const auto n = (int) PrimarySource::GetNumberOfParticles();
+    auto launchedHistogram = new TH1D("launched_primaries", "Launched primaries per source particle", n, 0, n);
+    auto activities = new TH1D("source_activities", "Fraction of the source activity", n, 0, n);
+    for (int i = 0; i < n; ++i) {
+        const auto &particle = PrimarySource::GetParticle(i);
+        const auto &name = particle.definition->GetParticleName();
+        launchedHistogram->GetXaxis()->SetBinLabel(i + 1, name.c_str());
+        launchedHistogram->SetBinContent(i + 1, (double) launched[i]);
+        activities->GetXaxis()->SetBinLabel(i + 1, name.c_str());
+        activities->SetBinContent(i + 1, particle.activity / PrimarySource::GetTotalActivity());
+    }
+}
+
+void RunAction::AddToSnapshot(Checkpoint::Snapshot &snapshot) {
+    for (size_t i = 0; i < snapshot.histograms.size(); ++i) {
+        snapshot.histograms[i].Add((*threadHistograms)[i]);
+    }
+    for (size_t i = 0; i < snapshot.totals.launchedPerParticle.size(); ++i) {
+        snapshot.totals.launchedPerParticle[i] += (*threadLaunchedPerParticle)[i];
+    }
+    // only this thread writes its counters
+    snapshot.totals.launchedPrimaries += threadCounters->launchedPrimaries.load(memory_order_relaxed);
+    snapshot.totals.secondaries += threadCounters->secondaries.load(memory_order_relaxed);
+    for (int reason = 0; reason < Culling::NumberOfReasons; ++reason) {
+        snapshot.totals.culled[reason] += threadCounters->culled[reason].load(memory_order_relaxed);
+    }
+}
+
+void RunAction::ReduceCounters() {
+    vector<unsigned long long> values = {GetLaunchedPrimaries(), GetSecondariesCount()};
+    for (int reason = 0; reason < Culling::NumberOfReasons; ++reason) {
+        values.push_back(GetCulledCount(reason));
+    }
+    const auto local = values;
+    MPIRun::Reduce(values);
+    MPIRun::Reduce(mergedLaunchedPerParticle);
+
+    // the other ranks are added to the slot of the master, so that the totals are the ones of the whole job
+    if (MPIRun::GetRank() == 0) {
+        auto &[launchedPrimaries, secondaries, culled] = masterCounters;
+        launchedPrimaries += values[0] - local[0];
+        secondaries += values[1] - local[1];
+        for (int reason = 0; reason < Culling::NumberOfReasons; ++reason) {
+            culled[reason] += values[2 + reason] - local[2 + reason];
+        }
+    }
+}
+
+void RunAction::SetShard(int index, int count) {
+    shardIndex = index;
+    shardCount = count;
 }
 
 void RunAction::SetOutputFilename(const string &name) {
@@ -307,42 +443,105 @@ int RunAction::GetRequestedSecondaries() {
     return RunAction::requestedSecondaries;
 }
 
-unsigned long long RunAction::GetSecondariesCount(bool lock) {
-    if (electronsMinusEnergyZenith == nullptr || electronsPlusEnergyZenith == nullptr ||
-        gammasEnergyZenith == nullptr || alphasEnergyZenith == nullptr ||
-        neutronsEnergyZenith == nullptr) {
-        return 0;
+void RunAction::SetNumberOfThreads(int nThreads) {
+    // must be called before the workers start
+    workerCounters = vector<atomic<Counters *>>(nThreads);
+    ownedWorkerCounters.clear();
+    threadCounters = &masterCounters;
+}
+
+template<typename Value>
+unsigned long long RunAction::SumCounters(Value value) {
+    unsigned long long count = value(masterCounters) + value(resumedCounters);
+    for (const auto &slot: workerCounters) {
+        if (const auto counter = slot.load(memory_order_acquire)) {
+            count += value(*counter);
+        }
+    }
+    return count;
+}
+
+unsigned long long RunAction::GetSecondariesCount() {
+    return SumCounters([](const Counters &counter) {
+        return counter.secondaries.load(memory_order_relaxed);
+    });
+}
+
+void RunAction::CheckSecondariesQuota() {
+    // enforced over all the ranks by the allocation of the event blocks
+    if (MPIRun::IsEnabled()) {
+        return;
+    }
+    if (requestedSecondaries <= 0 || GetSecondariesCount() < requestedSecondaries) {
+        return;
     }
+    RequestAbort();
+}
+
+void RunAction::IncreaseCulled(int reason) {
+    auto &culled = threadCounters->culled[reason];
+    culled.store(culled.load(memory_order_relaxed) + 1, memory_order_relaxed);
+}
 
-    if (lock) {
-        outputMutex.lock();
+unsigned long long RunAction::GetCulledCount(int reason) {
+    return SumCounters([reason](const Counters &counter) {
+        return counter.culled[reason].load(memory_order_relaxed);
+    });
+}
+
+void RunAction::RequestAbort() {
+    // only the first thread to ask aborts, the master run manager propagates it to all workers
+    if (!abortRequested.exchange(true)) {
+        G4RunManagerFactory::GetMasterRunManager()->AbortRun(true);
     }
-    auto count = electronsMinusEnergyZenith->GetEntries() + electronsPlusEnergyZenith->GetEntries() +
-                 gammasEnergyZenith->GetEntries() + alphasEnergyZenith->GetEntries() +
-                 neutronsEnergyZenith->GetEntries();
-    if (lock) {
-        outputMutex.unlock();
+}
+
+double RunAction::GetSourceThickness() {
+    if (PhaseSpaceReader::IsEnabled()) {
+        return PhaseSpaceReader::GetHeader().sourceThickness * mm;
     }
-    return count;
+    return DetectorConstruction::GetThickness();
 }
 
-void RunAction::IncreaseLaunchedPrimaries(const string &particleName) {
-    lock_guard<std::mutex> lock(inputMutex);
-    RunAction::launchedPrimariesMap[particleName]++;
+bool RunAction::IsSurfaceSource() {
+    if (PhaseSpaceReader::IsEnabled()) {
+        return PhaseSpaceReader::GetHeader().surfaceSource;
+    }
+    return Spectrum::IsLoaded();
 }
 
-void RunAction::SetDepth(double depth) {
-    RunAction::depth = depth;
+double RunAction::GetEquivalentPrimaries() {
+    return GetEquivalentPrimaries(GetLaunchedPrimaries());
 }
 
-unsigned int RunAction::GetLaunchedPrimaries(bool lock) {
-    if (lock) {
-        inputMutex.lock();
+double RunAction::GetEquivalentPrimaries(unsigned long long launchedPrimaries) {
+    const auto launched = (double) launchedPrimaries;
+    if (PhaseSpaceReader::IsEnabled()) {
+        // each replayed record stands for its share of the primaries that produced the file
+        const auto &header = PhaseSpaceReader::GetHeader();
+        return header.launchedPrimaries * launched / (double) header.records;
     }
-    auto count = std::accumulate(launchedPrimariesMap.begin(), launchedPrimariesMap.end(), 0,
-                                 [](unsigned int sum, const auto &entry) { return sum + entry.second; });
-    if (lock) {
-        inputMutex.unlock();
+    return launched;
+}
+
+void RunAction::IncreaseLaunchedPrimaries(int particle) {
+    auto &launchedPrimaries = threadCounters->launchedPrimaries;
+    launchedPrimaries.store(launchedPrimaries.load(memory_order_relaxed) + 1, memory_order_relaxed);
+    if (particle >= 0) {
+        ++(*threadLaunchedPerParticle)[particle];
     }
-    return count;
+}
+
+void RunAction::SetDepth(double depth) {
+    RunAction::depth = depth;
+}
+
+void RunAction::SetEventIndex(uint64_t eventIndex) {
+    RunAction::eventIndex = eventIndex;
+}
+
+unsigned long long RunAction::GetLaunchedPrimaries() {
+    return SumCounters([](const Counters &counter) {
+        return counter.launchedPrimaries.load(memory_order_relaxed);
+    });
 }
@@ -1,11 +1,23 @@
 #pragma once
 
+#include "Binning.h"
+#include "Checkpoint.h"
+#include "Culling.h"
+#include "SecondaryHit.h"
+#include "SpeciesHistograms.h"
+
 #include <G4RunManager.hh>
 #include <G4UserRunAction.hh>
 
 #include <TFile.h>
-#include <TH1D.h>
-#include <TH2D.h>
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <vector>
 
 class RunAction : public G4UserRunAction {
 public:
@@ -15,12 +27,13 @@ public:
 
     void EndOfRunAction(const G4Run*) override;
 
-    static void InsertTrack(const G4Track* track);
-
-    static void SetInputParticle(const std::string& particleName);
+    static void InsertHits(const SecondaryHitsCollection& hits);
 
     static void SetOutputFilename(const std::string& outputFilename);
 
+    // "[SPECIES/]AXIS=SCALE:N:MIN:MAX", e.g. "energy=log:5000:1e-4:100" or "neutron/energy=log:2000:1e-9:20"
+    static void SetBinning(const std::vector<std::string>& specifications);
+
     static void SetRequestedPrimaries(int);
 
     static int GetRequestedPrimaries();
@@ -29,55 +42,128 @@ public:
 
     static int GetRequestedSecondaries();
 
-    static void IncreaseLaunchedPrimaries(const std::string&);
+    static void SetNumberOfThreads(int);
+
+    // particle is the PrimarySource index, -1 when primaries do not come from it
+    static void IncreaseLaunchedPrimaries(int particle = -1);
 
     static double GetDepth() { return depth; }
 
     static void SetDepth(double depth);
 
-    static unsigned int GetLaunchedPrimaries(bool lock = true);
+    // global index of the event in progress on this thread, across the shards or the MPI ranks
+    static uint64_t GetEventIndex() { return eventIndex; }
+
+    static void SetEventIndex(uint64_t eventIndex);
+
+    static unsigned long long GetLaunchedPrimaries();
+
+    static unsigned long long GetSecondariesCount();
+
+    static void CheckSecondariesQuota();
+
+    // reason is a Culling::Reason
+    static void IncreaseCulled(int reason);
+
+    static unsigned long long GetCulledCount(int reason);
 
-    static unsigned long long GetSecondariesCount(bool lock = true);
+    // aborts the run on all threads, can be called from any of them
+    static void RequestAbort();
 
-    static std::string GetParticleName() { return inputParticleName; }
+    // thickness of the stack the primaries were launched in, which may be upstream of a replayed phase-space
+    static double GetSourceThickness();
+
+    // primaries launched in the source stack, the histograms are normalized to them
+    static double GetEquivalentPrimaries();
+
+    static double GetEquivalentPrimaries(unsigned long long launchedPrimaries);
+
+    // primaries come from an input spectrum on the upstream face instead of decays inside the stack,
+    // the histograms are then normalized per primary instead of per unit of activity and thickness
+    static bool IsSurfaceSource();
+
+    // the histograms are written unnormalized, with the metadata to merge them with the other shards
+    static void SetShard(int index, int count);
+
+    static bool IsShard() { return shardCount > 0; }
+
+    // adds the histograms and counters of the calling thread
+    static void AddToSnapshot(Checkpoint::Snapshot& snapshot);
+
+    // written to the current directory, launched is indexed by the PrimarySource particle
+    static void WriteSourceSummary(const std::vector<unsigned long long>& launched);
 
 private:
+    // indexed by the SpeciesRegistry slot
+    using Histograms = std::vector<SpeciesHistograms>;
+
+    static void CreateBinnings();
+
+    // keyed by "AXIS" or "SPECIES/AXIS"
+    static std::map<std::string, Axis> binningOverrides;
+    // indexed by the SpeciesRegistry slot, must not be resized while histograms refer to it
+    static std::vector<Binning> binnings;
+
+    // each worker fills its own set, the master merges them at the end of the run
+    Histograms histograms;
+
+    static Histograms mergedHistograms;
+    static thread_local Histograms* threadHistograms;
+
+    // indexed by the PrimarySource particle, merged like the histograms
+    std::vector<unsigned long long> launchedPerParticle;
+    static std::vector<unsigned long long> mergedLaunchedPerParticle;
+    static thread_local std::vector<unsigned long long>* threadLaunchedPerParticle;
+
+    // sums the counters of every rank into the ones of rank 0
+    static void ReduceCounters();
+
+    // hits of an event regrouped by species, to fill the histograms in batches
+    struct HitBuffer {
+        std::vector<double> energy;
+        std::vector<double> cosZenith;
+        std::vector<double> depth;
+        std::vector<double> weight;
+    };
+    static thread_local std::vector<HitBuffer> hitBuffers;
+
+    static std::vector<RunAction*> workers;
+
+    // written only by the owning thread and read without locks by the progress thread and the quota check.
+    // Padded to a cache line so that workers never write to the same one
+    struct alignas(64) Counters {
+        std::atomic<unsigned long long> launchedPrimaries = 0;
+        std::atomic<unsigned long long> secondaries = 0;
+        std::array<std::atomic<unsigned long long>, Culling::NumberOfReasons> culled{};
+    };
+
+    // used by the master, or by the only thread in sequential mode
+    static Counters masterCounters;
+    // counts of the checkpoint this run was resumed from, only added to the totals
+    static Counters resumedCounters;
+    // slot i is worker i. Each worker allocates its own counters on its first run, after being pinned, so that
+    // they are first touched on its NUMA node. Empty slots are skipped by the readers
+    static std::vector<std::atomic<Counters*>> workerCounters;
+    static std::vector<std::unique_ptr<Counters>> ownedWorkerCounters;
+    static thread_local Counters* threadCounters;
+
+    // adds up value(counters) over the master, the resumed checkpoint and every worker that already allocated its own
+    template<typename Value>
+    static unsigned long long SumCounters(Value value);
+    static std::atomic<bool> abortRequested;
+
+    static int shardIndex;
+    static int shardCount;
+
     static int requestedPrimaries;
     static int requestedSecondaries;
     static thread_local double depth;
-
-    static std::map<std::string, double> launchedPrimariesMap;
+    static thread_local uint64_t eventIndex;
 
     static std::string inputFilename;
     static std::string outputFilename;
 
-    static std::mutex inputMutex;
     static std::mutex outputMutex;
 
-    static std::string inputParticleName;
     static TFile* outputFile;
-
-    static TH1D* electronsMinusEnergy;
-    static TH1D* electronsPlusEnergy;
-    static TH1D* gammasEnergy;
-    static TH1D* alphasEnergy;
-    static TH1D* neutronsEnergy;
-
-    static TH1D* electronsMinusZenith;
-    static TH1D* electronsPlusZenith;
-    static TH1D* gammasZenith;
-    static TH1D* alphasZenith;
-    static TH1D* neutronsZenith;
-
-    static TH2D* electronsMinusEnergyZenith;
-    static TH2D* electronsPlusEnergyZenith;
-    static TH2D* gammasEnergyZenith;
-    static TH2D* alphasEnergyZenith;
-    static TH2D* neutronsEnergyZenith;
-
-    static TH1D* electronsMinusDepht;
-    static TH1D* electronsPlusDepht;
-    static TH1D* gammasDepht;
-    static TH1D* alphasDepht;
-    static TH1D* neutronsDepht;
-};
\ No newline at end of file
+};
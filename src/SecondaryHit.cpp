@@ -0,0 +1,4 @@
+
+#include "SecondaryHit.h"
+
+G4ThreadLocal G4Allocator<SecondaryHit> *SecondaryHitAllocator = nullptr;
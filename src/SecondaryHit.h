@@ -0,0 +1,48 @@
+
+#pragma once
+
+#include <G4Allocator.hh>
+#include <G4THitsCollection.hh>
+#include <G4ThreeVector.hh>
+#include <G4VHit.hh>
+
+// Secondary crossing the detector plane
+class SecondaryHit : public G4VHit {
+public:
+    SecondaryHit() = default;
+
+    SecondaryHit(int species, double energy, const G4ThreeVector& direction, double depth, double weight, int process)
+        : species(species), energy(energy), direction(direction), depth(depth), weight(weight), process(process) {}
+
+    inline void* operator new(size_t);
+
+    inline void operator delete(void* hit);
+
+    // SpeciesRegistry slot
+    int species = -1;
+    // kinetic energy (MeV)
+    double energy = 0;
+    // momentum direction, z is the cosine of the angle with the detector normal
+    G4ThreeVector direction;
+    // distance (mm) from the decay to the detector plane
+    double depth = 0;
+    // track weight, different from 1 when the sampling is biased
+    double weight = 1;
+    // SecondaryWriter index of the creator process, -1 for primaries or when the secondaries are not written
+    int process = -1;
+};
+
+using SecondaryHitsCollection = G4THitsCollection<SecondaryHit>;
+
+extern G4ThreadLocal G4Allocator<SecondaryHit>* SecondaryHitAllocator;
+
+inline void* SecondaryHit::operator new(size_t) {
+    if (SecondaryHitAllocator == nullptr) {
+        SecondaryHitAllocator = new G4Allocator<SecondaryHit>;
+    }
+    return (void*) SecondaryHitAllocator->MallocSingle();
+}
+
+inline void SecondaryHit::operator delete(void* hit) {
+    SecondaryHitAllocator->FreeSingle((SecondaryHit*) hit);
+}
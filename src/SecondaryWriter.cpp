@@ -0,0 +1,229 @@
+
+#include "SecondaryWriter.h"
+#include "SpeciesRegistry.h"
+
+#include <algorithm>
+
+using namespace std;
+
+string SecondaryWriter::outputFilename;
+// ROOT default: zlib level 1
+int SecondaryWriter::compression = 101;
+int SecondaryWriter::basketSize = 32000;
+long long SecondaryWriter::autoFlush = -30000000;
+
+TFile *SecondaryWriter::outputFile = nullptr;
+TTree *SecondaryWriter::tree = nullptr;
+thread SecondaryWriter::writerThread;
+
+deque<unique_ptr<SecondaryWriter::Buffer>> SecondaryWriter::pendingBuffers;
+vector<unique_ptr<SecondaryWriter::Buffer>> SecondaryWriter::freeBuffers;
+mutex SecondaryWriter::queueMutex;
+condition_variable SecondaryWriter::queueCondition;
+condition_variable SecondaryWriter::spaceCondition;
+bool SecondaryWriter::stopRequested = false;
+
+thread_local unique_ptr<SecondaryWriter::Buffer> SecondaryWriter::threadBuffer;
+
+vector<string> SecondaryWriter::processNames;
+mutex SecondaryWriter::processMutex;
+thread_local unordered_map<const G4VProcess *, int> SecondaryWriter::threadProcessIndices;
+
+void SecondaryWriter::SetOutputFilename(const string &filename) {
+    outputFilename = filename;
+}
+
+void SecondaryWriter::SetCompression(int newValue) {
+    compression = newValue;
+}
+
+void SecondaryWriter::SetBasketSize(int newValue) {
+    basketSize = newValue;
+}
+
+void SecondaryWriter::SetAutoFlush(long long newValue) {
+    autoFlush = newValue;
+}
+
+void SecondaryWriter::Buffer::clear() {
+    eventID.clear();
+    species.clear();
+    energy.clear();
+    directionX.clear();
+    directionY.clear();
+    directionZ.clear();
+    depth.clear();
+    weight.clear();
+    process.clear();
+}
+
+void SecondaryWriter::Start() {
+    // opened here so that a bad path fails before any event is simulated
+    outputFile = new TFile(outputFilename.c_str(), "RECREATE", "", compression);
+    if (outputFile->IsZombie()) {
+        throw runtime_error("Could not open secondaries output file " + outputFilename);
+    }
+
+    stopRequested = false;
+    writerThread = thread(WriteBuffers);
+}
+
+void SecondaryWriter::Stop() {
+    {
+        lock_guard<mutex> lock(queueMutex);
+        stopRequested = true;
+    }
+    queueCondition.notify_one();
+    writerThread.join();
+
+    delete outputFile;
+    outputFile = nullptr;
+}
+
+unique_ptr<SecondaryWriter::Buffer> SecondaryWriter::AcquireBuffer() {
+    {
+        lock_guard<mutex> lock(queueMutex);
+        if (!freeBuffers.empty()) {
+            auto buffer = std::move(freeBuffers.back());
+            freeBuffers.pop_back();
+            return buffer;
+        }
+    }
+    auto buffer = make_unique<Buffer>();
+    buffer->eventID.reserve(bufferSize);
+    buffer->species.reserve(bufferSize);
+    buffer->energy.reserve(bufferSize);
+    buffer->directionX.reserve(bufferSize);
+    buffer->directionY.reserve(bufferSize);
+    buffer->directionZ.reserve(bufferSize);
+    buffer->depth.reserve(bufferSize);
+    buffer->weight.reserve(bufferSize);
+    buffer->process.reserve(bufferSize);
+    return buffer;
+}
+
+void SecondaryWriter::Insert(const SecondaryHitsCollection &hits, uint64_t eventIndex) {
+    if (threadBuffer == nullptr) {
+        threadBuffer = AcquireBuffer();
+    }
+
+    auto &buffer = *threadBuffer;
+    for (size_t i = 0; i < hits.entries(); ++i) {
+        const auto hit = hits[i];
+        buffer.eventID.push_back(eventIndex);
+        buffer.species.push_back(hit->species);
+        buffer.energy.push_back(hit->energy);
+        buffer.directionX.push_back(hit->direction.x());
+        buffer.directionY.push_back(hit->direction.y());
+        buffer.directionZ.push_back(hit->direction.z());
+        buffer.depth.push_back(hit->depth);
+        buffer.weight.push_back(hit->weight);
+        buffer.process.push_back(hit->process);
+    }
+
+    if (buffer.size() >= bufferSize) {
+        Flush();
+    }
+}
+
+void SecondaryWriter::Flush() {
+    if (threadBuffer == nullptr || threadBuffer->size() == 0) {
+        return;
+    }
+    {
+        // memory stays bounded when the disk is slower than the simulation
+        unique_lock<mutex> lock(queueMutex);
+        spaceCondition.wait(lock, [] { return pendingBuffers.size() < maxPendingBuffers; });
+        pendingBuffers.push_back(std::move(threadBuffer));
+    }
+    queueCondition.notify_one();
+}
+
+void SecondaryWriter::WriteBuffers() {
+    Long64_t eventID;
+    int species, process;
+    double energy, directionX, directionY, directionZ, depth, weight;
+
+    {
+        TDirectory::TContext context(outputFile);
+        tree = new TTree("secondaries", "Scored secondaries: energy (MeV), direction and depth (mm)");
+    }
+    tree->Branch("eventID", &eventID);
+    tree->Branch("species", &species);
+    tree->Branch("energy", &energy);
+    tree->Branch("directionX", &directionX);
+    tree->Branch("directionY", &directionY);
+    tree->Branch("directionZ", &directionZ);
+    tree->Branch("depth", &depth);
+    tree->Branch("weight", &weight);
+    tree->Branch("process", &process);
+    tree->SetBasketSize("*", basketSize);
+    tree->SetAutoFlush(autoFlush);
+
+    while (true) {
+        unique_ptr<Buffer> buffer;
+        {
+            unique_lock<mutex> lock(queueMutex);
+            queueCondition.wait(lock, [] { return stopRequested || !pendingBuffers.empty(); });
+            if (pendingBuffers.empty()) {
+                break;
+            }
+            buffer = std::move(pendingBuffers.front());
+            pendingBuffers.pop_front();
+        }
+        spaceCondition.notify_all();
+
+        for (size_t i = 0; i < buffer->size(); ++i) {
+            eventID = (Long64_t) buffer->eventID[i];
+            species = buffer->species[i];
+            energy = buffer->energy[i];
+            directionX = buffer->directionX[i];
+            directionY = buffer->directionY[i];
+            directionZ = buffer->directionZ[i];
+            depth = buffer->depth[i];
+            weight = buffer->weight[i];
+            process = buffer->process[i];
+            tree->Fill();
+        }
+
+        buffer->clear();
+        lock_guard<mutex> lock(queueMutex);
+        freeBuffers.push_back(std::move(buffer));
+    }
+
+    // the "species" and "process" columns index these lists
+    vector<string> speciesNames;
+    for (size_t i = 0; i < SpeciesRegistry::GetNumberOfSpecies(); ++i) {
+        speciesNames.push_back(SpeciesRegistry::GetSpecies(i).particleName);
+    }
+
+    tree->Write();
+    outputFile->WriteObject(&speciesNames, "species");
+    {
+        lock_guard<mutex> lock(processMutex);
+        outputFile->WriteObject(&processNames, "processes");
+    }
+    // also deletes the tree
+    outputFile->Close();
+    tree = nullptr;
+}
+
+int SecondaryWriter::GetProcessIndex(const G4VProcess *process) {
+    if (process == nullptr) {
+        return -1;
+    }
+
+    const auto it = threadProcessIndices.find(process);
+    if (it != threadProcessIndices.end()) {
+        return it->second;
+    }
+
+    lock_guard<mutex> lock(processMutex);
+    const auto &name = process->GetProcessName();
+    auto index = (int) (find(processNames.begin(), processNames.end(), name) - processNames.begin());
+    if (index == (int) processNames.size()) {
+        processNames.push_back(name);
+    }
+    threadProcessIndices[process] = index;
+    return index;
+}
@@ -0,0 +1,101 @@
+
+#pragma once
+
+#include "SecondaryHit.h"
+
+#include <G4VProcess.hh>
+
+#include <TFile.h>
+#include <TTree.h>
+
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+// Optional per-secondary output: one TTree entry per scored hit. Workers append to a thread local buffer which,
+// once full, is handed to a background thread that fills the tree, so compression and I/O never happen in a worker
+class SecondaryWriter {
+public:
+    static void SetOutputFilename(const std::string& filename);
+
+    static bool IsEnabled() { return !outputFilename.empty(); }
+
+    // ROOT compression setting: algorithm * 100 + level, e.g. 505 for ZSTD level 5
+    static void SetCompression(int compression);
+
+    static void SetBasketSize(int basketSize);
+
+    // TTree::SetAutoFlush: entries per cluster if positive, bytes if negative
+    static void SetAutoFlush(long long autoFlush);
+
+    // called by the master before the workers start
+    static void Start();
+
+    // eventIndex is the global index of the event, the one it is seeded or replayed from
+    static void Insert(const SecondaryHitsCollection& hits, uint64_t eventIndex);
+
+    // hands the partially filled buffer of the calling thread to the writer, blocks while its queue is full
+    static void Flush();
+
+    // called by the master after the workers are done, writes everything and closes the file
+    static void Stop();
+
+    // index of the process in the list written to the output, -1 for primaries
+    static int GetProcessIndex(const G4VProcess* process);
+
+private:
+    static constexpr size_t bufferSize = 16384;
+    // about 60 MB of hits, workers wait in Flush once the writer is this far behind
+    static constexpr size_t maxPendingBuffers = 64;
+
+    struct Buffer {
+        std::vector<uint64_t> eventID;
+        std::vector<int> species;
+        std::vector<double> energy;
+        std::vector<double> directionX;
+        std::vector<double> directionY;
+        std::vector<double> directionZ;
+        std::vector<double> depth;
+        std::vector<double> weight;
+        std::vector<int> process;
+
+        size_t size() const { return eventID.size(); }
+
+        void clear();
+    };
+
+    static std::unique_ptr<Buffer> AcquireBuffer();
+
+    static void WriteBuffers();
+
+    static std::string outputFilename;
+    static int compression;
+    static int basketSize;
+    static long long autoFlush;
+
+    static TFile* outputFile;
+    static TTree* tree;
+    static std::thread writerThread;
+
+    // full buffers waiting to be written and written ones ready to be reused, both guarded by queueMutex
+    static std::deque<std::unique_ptr<Buffer>> pendingBuffers;
+    static std::vector<std::unique_ptr<Buffer>> freeBuffers;
+    static std::mutex queueMutex;
+    static std::condition_variable queueCondition;
+    // signaled by the writer when it takes a buffer out of a full queue
+    static std::condition_variable spaceCondition;
+    static bool stopRequested;
+
+    static thread_local std::unique_ptr<Buffer> threadBuffer;
+
+    // process objects are per thread, they are identified by name in the output
+    static std::vector<std::string> processNames;
+    static std::mutex processMutex;
+    static thread_local std::unordered_map<const G4VProcess*, int> threadProcessIndices;
+};
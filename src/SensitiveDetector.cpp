@@ -1,13 +1,21 @@
 
 #include <G4RunManager.hh>
+#include <G4SDManager.hh>
+#include <G4SystemOfUnits.hh>
 
 #include "SensitiveDetector.h"
+#include "PhaseSpace.h"
 #include "RunAction.h"
+#include "SecondaryWriter.h"
+#include "SpeciesRegistry.h"
 
 using namespace std;
+using namespace CLHEP;
 
 
-SensitiveDetector::SensitiveDetector(const string &name) : G4VSensitiveDetector(name) {}
+SensitiveDetector::SensitiveDetector(const string &name) : G4VSensitiveDetector(name) {
+    collectionName.insert(hitsCollectionName);
+}
 
 G4bool SensitiveDetector::ProcessHits(G4Step *step, G4TouchableHistory *) {
 
@@ -27,11 +35,31 @@ G4bool SensitiveDetector::ProcessHits(G4Step *step, G4TouchableHistory *) {
            << "positionOrigin=" << positionOrigin << endl;
     */
 
-    RunAction::InsertTrack(track);
-
     track->SetTrackStatus(fStopAndKill);
 
+    // every particle reaching the detector is kept in the phase-space, not only the scored species
+    if (PhaseSpaceWriter::IsEnabled()) {
+        PhaseSpaceWriter::Write(step, RunAction::GetDepth());
+    }
+
+    const auto species = SpeciesRegistry::GetIndex(track->GetParticleDefinition());
+    if (species < 0) {
+        return false;
+    }
+
+    const auto process = SecondaryWriter::IsEnabled() ? SecondaryWriter::GetProcessIndex(track->GetCreatorProcess()) : -1;
+
+    // hits are scored at the end of the event
+    hitsCollection->insert(new SecondaryHit(species, track->GetKineticEnergy() / MeV, track->GetMomentumDirection(),
+                                            RunAction::GetDepth(), track->GetWeight(), process));
+
     return true;
 }
 
-void SensitiveDetector::Initialize(G4HCofThisEvent *) {}
+void SensitiveDetector::Initialize(G4HCofThisEvent *hitsCollectionOfThisEvent) {
+    hitsCollection = new SecondaryHitsCollection(SensitiveDetectorName, collectionName[0]);
+    if (hitsCollectionID < 0) {
+        hitsCollectionID = G4SDManager::GetSDMpointer()->GetCollectionID(hitsCollection);
+    }
+    hitsCollectionOfThisEvent->AddHitsCollection(hitsCollectionID, hitsCollection);
+}
@@ -1,6 +1,8 @@
 
 #pragma once
 
+#include "SecondaryHit.h"
+
 #include <G4VSensitiveDetector.hh>
 
 
@@ -11,6 +13,11 @@ public:
 
     void Initialize(G4HCofThisEvent*) override;
     G4bool ProcessHits(G4Step*, G4TouchableHistory*) override;
-};
 
+    static constexpr auto hitsCollectionName = "SecondaryHits";
+
+private:
+    SecondaryHitsCollection* hitsCollection = nullptr;
+    G4int hitsCollectionID = -1;
+};
 
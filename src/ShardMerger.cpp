@@ -0,0 +1,146 @@
+
+#include "ShardMerger.h"
+#include "SpeciesHistograms.h"
+
+#include <G4SystemOfUnits.hh>
+
+#include <TFile.h>
+#include <TKey.h>
+
+#include <map>
+#include <memory>
+
+using namespace std;
+using namespace CLHEP;
+
+namespace {
+enum MetadataBin { EquivalentPrimaries = 1, SourceThickness, SurfaceSource, NumberOfMetadataBins = SurfaceSource };
+
+// species histograms are named SPECIES + suffix, see SpeciesHistograms::CreateROOTHistograms
+const string energySuffix = "_energy";
+}// namespace
+
+void ShardMerger::WriteMetadata(double equivalentPrimaries, double sourceThickness, bool surfaceSource,
+                                int shardIndex, int shardCount) {
+    auto metadata = new TH1D(metadataName, "Normalization of the shard", NumberOfMetadataBins, 0,
+                             NumberOfMetadataBins);
+    metadata->GetXaxis()->SetBinLabel(EquivalentPrimaries, "equivalent_primaries");
+    metadata->GetXaxis()->SetBinLabel(SourceThickness, "source_thickness_mm");
+    metadata->GetXaxis()->SetBinLabel(SurfaceSource, "surface_source");
+    metadata->SetBinContent(EquivalentPrimaries, equivalentPrimaries);
+    metadata->SetBinContent(SourceThickness, sourceThickness / mm);
+    metadata->SetBinContent(SurfaceSource, surfaceSource);
+
+    // summed by the merge, each bin must end up being 1
+    auto shards = new TH1D(shardsName, "Shards of the run", shardCount, 0, shardCount);
+    shards->SetBinContent(shardIndex + 1, 1);
+}
+
+ShardMerger::Metadata ShardMerger::ReadMetadata(TFile &file) {
+    const unique_ptr<TH1D> metadata(file.Get<TH1D>(metadataName));
+    if (metadata == nullptr) {
+        throw runtime_error(string(file.GetName()) + " is not a shard file, it has no " + metadataName);
+    }
+    metadata->SetDirectory(nullptr);
+    return {metadata->GetBinContent(EquivalentPrimaries), metadata->GetBinContent(SourceThickness) * mm,
+            metadata->GetBinContent(SurfaceSource) != 0};
+}
+
+void ShardMerger::Merge(const vector<string> &inputFilenames, const string &outputFilename) {
+    // sums the equivalent primaries, the other entries must be the same in every shard
+    double equivalentPrimaries = 0;
+    double sourceThickness = -1;
+    bool surfaceSource = false;
+
+    // one shard is open at a time, each of its histograms is added to its sum and freed before the next one is read.
+    // Every shard has the same objects, the first one lists them
+    map<string, unique_ptr<TH1>> sums;
+    for (const auto &filename: inputFilenames) {
+        const unique_ptr<TFile> file(TFile::Open(filename.c_str(), "READ"));
+        if (file == nullptr || file->IsZombie()) {
+            throw runtime_error("Could not open shard file " + filename);
+        }
+
+        const auto metadata = ReadMetadata(*file);
+        equivalentPrimaries += metadata.equivalentPrimaries;
+        if (sourceThickness >= 0 &&
+            (metadata.sourceThickness != sourceThickness || metadata.surfaceSource != surfaceSource)) {
+            throw runtime_error(filename + " was produced with a different source");
+        }
+        sourceThickness = metadata.sourceThickness;
+        surfaceSource = metadata.surfaceSource;
+
+        if (sums.empty()) {
+            for (int i = 0; i < file->GetListOfKeys()->GetSize(); ++i) {
+                const string name = file->GetListOfKeys()->At(i)->GetName();
+                // checkpoints also hold the state of their run
+                if (name != metadataName && !name.starts_with("checkpoint_")) {
+                    sums[name] = nullptr;
+                }
+            }
+        }
+
+        for (auto &[name, sum]: sums) {
+            if (sum != nullptr && name == "source_activities") {
+                // fractions of the source, the same in every shard
+                continue;
+            }
+            unique_ptr<TH1> histogram(file->Get<TH1>(name.c_str()));
+            if (histogram == nullptr) {
+                throw runtime_error("Histogram " + name + " not found in " + filename);
+            }
+            histogram->SetDirectory(nullptr);
+            if (sum == nullptr) {
+                sum = std::move(histogram);
+            } else if (!sum->Add(histogram.get())) {
+                throw runtime_error("Histogram " + name + " of " + filename + " has a different binning");
+            }
+        }
+    }
+
+    const auto &shards = sums.at(shardsName);
+    int missing = 0;
+    for (int bin = 1; bin <= shards->GetNbinsX(); ++bin) {
+        if (shards->GetBinContent(bin) > 1) {
+            throw runtime_error("Shard " + to_string(bin - 1) + " is given more than once");
+        }
+        missing += shards->GetBinContent(bin) == 0;
+    }
+    if (missing > 0) {
+        // the result is still normalized correctly, with fewer primaries
+        G4cout << "Warning: " << missing << " of " << shards->GetNbinsX() << " shards are missing" << G4endl;
+    }
+
+    const auto scale = (surfaceSource ? 1.0 : sourceThickness) / equivalentPrimaries;
+    G4cout << "Merging " << inputFilenames.size() << " shards, " << equivalentPrimaries << " primaries" << G4endl;
+    G4cout << "Scale factor: " << scale << G4endl;
+
+    for (const auto &[name, sum]: sums) {
+        if (name.size() <= energySuffix.size() || !name.ends_with(energySuffix)) {
+            continue;
+        }
+        const auto species = name.substr(0, name.size() - energySuffix.size());
+        const auto energyZenith = sums.find(species + "_energy_zenith");
+        if (energyZenith == sums.end()) {
+            continue;
+        }
+        SpeciesHistograms::Normalize({dynamic_cast<TH1D *>(sum.get()),
+                                      dynamic_cast<TH1D *>(sums.at(species + "_zenith").get()),
+                                      dynamic_cast<TH2D *>(energyZenith->second.get()),
+                                      dynamic_cast<TH1D *>(sums.at(species + "_depth").get())},
+                                     scale);
+    }
+
+    unique_ptr<TFile> output(TFile::Open(outputFilename.c_str(), "RECREATE"));
+    if (output == nullptr || output->IsZombie()) {
+        throw runtime_error("Could not open output file " + outputFilename);
+    }
+    for (const auto &[name, sum]: sums) {
+        if (name != shardsName) {
+            output->WriteTObject(sum.get());
+        }
+    }
+
+    output->Close();
+    G4cout << "Merged histograms written to " << outputFilename << G4endl;
+}
@@ -0,0 +1,31 @@
+
+#pragma once
+
+#include <TFile.h>
+
+#include <string>
+#include <vector>
+
+// A run with --shard writes its histograms unnormalized, together with the metadata needed to normalize them:
+// the equivalent primaries, the source thickness and whether the source is a surface one, and which shard it is.
+// The merge command sums any number of such files and normalizes the result once
+class ShardMerger {
+public:
+    // written to the current directory
+    static void WriteMetadata(double equivalentPrimaries, double sourceThickness, bool surfaceSource, int shardIndex,
+                              int shardCount);
+
+    struct Metadata {
+        double equivalentPrimaries;
+        double sourceThickness;
+        bool surfaceSource;
+    };
+
+    static Metadata ReadMetadata(TFile& file);
+
+    // the files are read one at a time, only the sums and one histogram of the open file are held in memory
+    static void Merge(const std::vector<std::string>& inputFilenames, const std::string& outputFilename);
+
+    static constexpr const char* metadataName = "shard_metadata";
+    static constexpr const char* shardsName = "shards";
+};
@@ -0,0 +1,163 @@
+
+#include "SpeciesHistograms.h"
+
+#include <cmath>
+
+using namespace std;
+
+SpeciesHistograms::SpeciesHistograms(const Binning &binning)
+    : binning(&binning), energyZenith(binning.energy.GetNbins(), binning.zenith.GetNbins()) {
+    energy.resize(binning.energy.GetNbins() + 2);
+    zenith.resize(binning.zenith.GetNbins() + 2);
+    depth.resize(binning.depth.GetNbins() + 2);
+}
+
+void SpeciesHistograms::Fill(const double *energyValues, const double *cosZenithValues, const double *depthValues,
+                             const double *weights, size_t size) {
+    energyBins.resize(size);
+    zenithBins.resize(size);
+    depthBins.resize(size);
+
+    binning->energy.FindBins(energyValues, energyBins.data(), size);
+    binning->zenithLookup.FindBins(cosZenithValues, zenithBins.data(), size);
+    binning->depth.FindBins(depthValues, depthBins.data(), size);
+
+    for (size_t i = 0; i < size; ++i) {
+        const auto weight = weights[i];
+        if (weight == 1.0 && !IsWeighted()) {
+            energy[energyBins[i]] += 1;
+            zenith[zenithBins[i]] += 1;
+            energyZenith.Fill(energyBins[i], zenithBins[i]);
+            depth[depthBins[i]] += 1;
+            continue;
+        }
+        if (!IsWeighted()) {
+            EnableWeights();
+        }
+        energy[energyBins[i]] += weight;
+        energySumw2[energyBins[i]] += weight * weight;
+        zenith[zenithBins[i]] += weight;
+        zenithSumw2[zenithBins[i]] += weight * weight;
+        energyZenith.Fill(energyBins[i], zenithBins[i], weight);
+        depth[depthBins[i]] += weight;
+        depthSumw2[depthBins[i]] += weight * weight;
+    }
+    entries += size;
+}
+
+void SpeciesHistograms::EnableWeights() {
+    energySumw2 = energy;
+    zenithSumw2 = zenith;
+    depthSumw2 = depth;
+}
+
+void SpeciesHistograms::Add(const SpeciesHistograms &other) {
+    const auto add = [](vector<double> &to, const vector<double> &from) {
+        for (size_t i = 0; i < to.size(); ++i) {
+            to[i] += from[i];
+        }
+    };
+    if (other.IsWeighted() && !IsWeighted()) {
+        EnableWeights();
+    }
+    if (IsWeighted()) {
+        add(energySumw2, other.IsWeighted() ? other.energySumw2 : other.energy);
+        add(zenithSumw2, other.IsWeighted() ? other.zenithSumw2 : other.zenith);
+        add(depthSumw2, other.IsWeighted() ? other.depthSumw2 : other.depth);
+    }
+    add(energy, other.energy);
+    add(zenith, other.zenith);
+    energyZenith.Add(other.energyZenith);
+    add(depth, other.depth);
+    entries += other.entries;
+}
+
+// sumw2 is empty for unweighted histograms, whose errors are the square root of the contents
+static TH1D *CreateTH1D(const string &name, const string &title, const Axis &axis, const vector<double> &contents,
+                        const vector<double> &sumw2, double entries) {
+    TH1D *histogram;
+    if (axis.GetScale() == Axis::Scale::Linear) {
+        histogram = new TH1D(name.c_str(), title.c_str(), axis.GetNbins(), axis.GetMin(), axis.GetMax());
+    } else {
+        histogram = new TH1D(name.c_str(), title.c_str(), axis.GetNbins(), axis.GetEdges().data());
+    }
+    if (!sumw2.empty()) {
+        histogram->Sumw2();
+    }
+    for (size_t bin = 0; bin < contents.size(); ++bin) {
+        histogram->SetBinContent((int) bin, contents[bin]);
+        if (!sumw2.empty()) {
+            histogram->SetBinError((int) bin, sqrt(sumw2[bin]));
+        }
+    }
+    histogram->SetEntries(entries);
+    return histogram;
+}
+
+SpeciesHistograms::ROOTHistograms SpeciesHistograms::CreateROOTHistograms(const string &name,
+                                                                          const string &label) const {
+    ROOTHistograms histograms;
+
+    histograms.energy = CreateTH1D(name + "_energy", label + " Kinetic Energy (MeV)", binning->energy, energy,
+                                   energySumw2, entries);
+    histograms.energy->GetXaxis()->SetTitle("Energy (MeV)");
+    histograms.energy->GetYaxis()->SetTitle("Hz / MeV / (Bq / mm)");
+
+    histograms.zenith = CreateTH1D(name + "_zenith", label + " Zenith Angle (degrees)", binning->zenith, zenith,
+                                   zenithSumw2, entries);
+    histograms.zenith->GetXaxis()->SetTitle("Zenith Angle (degrees)");
+    histograms.zenith->GetYaxis()->SetTitle("Counts");
+
+    const auto &energyAxis = binning->energy;
+    const auto &zenithAxis = binning->zenith;
+    const auto title = label + " Kinetic Energy (MeV) vs Zenith Angle (degrees)";
+    if (energyAxis.GetScale() == Axis::Scale::Linear && zenithAxis.GetScale() == Axis::Scale::Linear) {
+        histograms.energyZenith = new TH2D((name + "_energy_zenith").c_str(), title.c_str(),
+                                           energyAxis.GetNbins(), energyAxis.GetMin(), energyAxis.GetMax(),
+                                           zenithAxis.GetNbins(), zenithAxis.GetMin(), zenithAxis.GetMax());
+    } else {
+        histograms.energyZenith = new TH2D((name + "_energy_zenith").c_str(), title.c_str(),
+                                           energyAxis.GetNbins(), energyAxis.GetEdges().data(),
+                                           zenithAxis.GetNbins(), zenithAxis.GetEdges().data());
+    }
+    energyZenith.CopyTo(histograms.energyZenith);
+    histograms.energyZenith->SetEntries(entries);
+    histograms.energyZenith->GetXaxis()->SetTitle("Energy (MeV)");
+    histograms.energyZenith->GetYaxis()->SetTitle("Zenith Angle (degrees)");
+    histograms.energyZenith->GetZaxis()->SetTitle("Counts");
+
+    histograms.depth = CreateTH1D(name + "_depth", label + " Depth (mm)", binning->depth, depth, depthSumw2,
+                                  entries);
+
+    return histograms;
+}
+
+// divides each bin by the width of its energy (x) bin. Under / overflow use the mean width
+static void ScalePerEnergyBinWidth(TH1 *histogram, double scale) {
+    const auto entries = histogram->GetEntries();
+    if (histogram->GetSumw2N() == 0) {
+        histogram->Sumw2();
+    }
+
+    const auto axis = histogram->GetXaxis();
+    const auto meanWidth = (axis->GetXmax() - axis->GetXmin()) / axis->GetNbins();
+    for (int bin = 0; bin < histogram->GetNcells(); ++bin) {
+        int x, y, z;
+        histogram->GetBinXYZ(bin, x, y, z);
+        const auto width = x >= 1 && x <= axis->GetNbins() ? axis->GetBinWidth(x) : meanWidth;
+        histogram->SetBinContent(bin, histogram->GetBinContent(bin) * scale / width);
+        histogram->SetBinError(bin, histogram->GetBinError(bin) * scale / width);
+    }
+    histogram->SetEntries(entries);
+}
+
+void SpeciesHistograms::Normalize(const ROOTHistograms &histograms, double scale) {
+    ScalePerEnergyBinWidth(histograms.energy, scale);
+    ScalePerEnergyBinWidth(histograms.energyZenith, scale);
+
+    // zenith and depth are scaled by the mean energy bin width, as they always have been
+    const auto energyAxis = histograms.energy->GetXaxis();
+    const auto meanEnergyWidth = (energyAxis->GetXmax() - energyAxis->GetXmin()) / energyAxis->GetNbins();
+    histograms.zenith->Scale(scale / meanEnergyWidth);
+    histograms.depth->Scale(scale / meanEnergyWidth);
+}
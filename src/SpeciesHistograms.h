@@ -0,0 +1,63 @@
+
+#pragma once
+
+#include "Binning.h"
+#include "TiledHistogram2D.h"
+
+#include <TH1D.h>
+#include <TH2D.h>
+
+#include <string>
+#include <vector>
+
+// Energy, zenith, energy vs zenith and depth histograms of one scored species. The 1D histograms are dense bin arrays,
+// the 2D one only allocates the regions that are filled. Each thread fills its own instance, which are added up by the master and converted to ROOT histograms
+// only when the output is written
+class SpeciesHistograms {
+public:
+    explicit SpeciesHistograms(const Binning& binning);
+
+    // fills a buffer of hits: energy (MeV), cosine of the zenith angle, depth (mm) and weight
+    void Fill(const double* energy, const double* cosZenith, const double* depth, const double* weight, size_t size);
+
+    void Add(const SpeciesHistograms& other);
+
+    double GetEntries() const { return entries; }
+
+    struct ROOTHistograms {
+        TH1D* energy = nullptr;
+        TH1D* zenith = nullptr;
+        TH2D* energyZenith = nullptr;
+        TH1D* depth = nullptr;
+    };
+
+    // histograms are created in the current directory
+    ROOTHistograms CreateROOTHistograms(const std::string& name, const std::string& label) const;
+
+    // multiplies by scale and divides by the width of the energy bins
+    static void Normalize(const ROOTHistograms& histograms, double scale);
+
+private:
+    const Binning* binning;
+
+    std::vector<double> energy;
+    std::vector<double> zenith;
+    TiledHistogram2D energyZenith;
+    std::vector<double> depth;
+    double entries = 0;
+
+    // sums of squared weights of the 1D histograms, empty until the first fill with a weight other than 1
+    std::vector<double> energySumw2;
+    std::vector<double> zenithSumw2;
+    std::vector<double> depthSumw2;
+
+    bool IsWeighted() const { return !energySumw2.empty(); }
+
+    // the fills so far all had unit weight, so the sums of squared weights start as the contents
+    void EnableWeights();
+
+    // scratch space for the bin indices of a buffer
+    std::vector<int> energyBins;
+    std::vector<int> zenithBins;
+    std::vector<int> depthBins;
+};
@@ -0,0 +1,84 @@
+
+#include "SpeciesRegistry.h"
+
+#include <G4ParticleTable.hh>
+
+#include <map>
+#include <stdexcept>
+
+using namespace std;
+
+vector<string> SpeciesRegistry::particleNames = SpeciesRegistry::GetDefaultSpecies();
+vector<SpeciesRegistry::Species> SpeciesRegistry::species;
+vector<const G4ParticleDefinition *> SpeciesRegistry::definitions;
+int SpeciesRegistry::ionIndex = -1;
+
+// histogram name prefix and title label of the common species, other particles use their own name
+const map<string, pair<string, string>> knownSpecies = {
+        {"e-", {"electron_minus", "Electron (e-)"}},
+        {"e+", {"electron_plus", "Electron (e+)"}},
+        {"gamma", {"gamma", "Gamma"}},
+        {"alpha", {"alpha", "Alpha"}},
+        {"neutron", {"neutron", "Neutron"}},
+        {"proton", {"proton", "Proton"}},
+        {"mu-", {"muon_minus", "Muon (mu-)"}},
+        {"mu+", {"muon_plus", "Muon (mu+)"}},
+        {"ion", {"ion", "Ion"}},
+};
+
+const vector<string> &SpeciesRegistry::GetDefaultSpecies() {
+    static const vector<string> defaultSpecies = {"e-", "e+", "gamma", "alpha", "neutron"};
+    return defaultSpecies;
+}
+
+void SpeciesRegistry::SetScoredSpecies(const vector<string> &names) {
+    particleNames = names;
+}
+
+void SpeciesRegistry::Initialize() {
+    species.clear();
+    definitions.clear();
+    ionIndex = -1;
+
+    auto particleTable = G4ParticleTable::GetParticleTable();
+    for (const auto &particleName: particleNames) {
+        Species entry;
+        entry.particleName = particleName;
+
+        const auto known = knownSpecies.find(particleName);
+        if (known != knownSpecies.end()) {
+            entry.name = known->second.first;
+            entry.label = known->second.second;
+        } else {
+            // histogram names cannot contain '+' or '-'
+            for (const auto c: particleName) {
+                if (c == '-') {
+                    entry.name += "_minus";
+                } else if (c == '+') {
+                    entry.name += "_plus";
+                } else {
+                    entry.name += c;
+                }
+            }
+            entry.label = particleName;
+        }
+
+        for (const auto &other: species) {
+            if (other.name == entry.name) {
+                throw runtime_error("Species " + particleName + " is scored more than once");
+            }
+        }
+
+        if (particleName == "ion") {
+            ionIndex = (int) species.size();
+        } else {
+            entry.definition = particleTable->FindParticle(particleName);
+            if (entry.definition == nullptr) {
+                throw runtime_error("Scored species " + particleName + " not found in the particle table");
+            }
+        }
+
+        species.push_back(entry);
+        definitions.push_back(entry.definition);
+    }
+}
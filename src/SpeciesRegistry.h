@@ -0,0 +1,54 @@
+
+#pragma once
+
+#include <G4ParticleDefinition.hh>
+
+#include <string>
+#include <vector>
+
+// Maps the particle definitions of the scored species to a histogram slot.
+// Definitions are resolved once at the beginning of the run, so scoring a hit is a pointer comparison
+class SpeciesRegistry {
+public:
+    struct Species {
+        std::string particleName;
+        // prefix of the histogram names
+        std::string name;
+        // used in the histogram titles
+        std::string label;
+        const G4ParticleDefinition* definition = nullptr;
+    };
+
+    static void SetScoredSpecies(const std::vector<std::string>& particleNames);
+
+    static const std::vector<std::string>& GetDefaultSpecies();
+
+    static void Initialize();
+
+    static size_t GetNumberOfSpecies() { return species.size(); }
+
+    static const Species& GetSpecies(size_t index) { return species[index]; }
+
+    // returns -1 for particles that are not scored
+    static int GetIndex(const G4ParticleDefinition* particle) {
+        for (size_t i = 0; i < definitions.size(); ++i) {
+            if (definitions[i] == particle) {
+                return (int) i;
+            }
+        }
+        if (ionIndex >= 0 && particle->IsGeneralIon()) {
+            return ionIndex;
+        }
+        return -1;
+    }
+
+private:
+    static std::vector<std::string> particleNames;
+    static std::vector<Species> species;
+
+    // same order as species, kept separate so that the lookup scans a compact array
+    static std::vector<const G4ParticleDefinition*> definitions;
+
+    // slot of the "ion" species, which collects every generic ion
+    static int ionIndex;
+};
@@ -0,0 +1,67 @@
+
+#include "Spectrum.h"
+#include "HistogramReader.h"
+
+#include <G4PhysicalConstants.hh>
+#include <G4SystemOfUnits.hh>
+
+using namespace std;
+using namespace CLHEP;
+
+AliasTable Spectrum::table;
+vector<double> Spectrum::energyEdges;
+vector<double> Spectrum::zenithEdges;
+
+static vector<double> GetEdges(const TAxis *axis) {
+    vector<double> edges;
+    for (int bin = 1; bin <= axis->GetNbins() + 1; ++bin) {
+        edges.push_back(axis->GetBinLowEdge(bin));
+    }
+    return edges;
+}
+
+void Spectrum::Load(const string &filename, const string &histogramName) {
+    const auto histogram = ReadHistogram(filename, histogramName);
+    if (histogram->GetDimension() > 2) {
+        throw runtime_error("Input spectrum must be a TH1 (energy) or a TH2 (energy vs zenith angle)");
+    }
+
+    energyEdges = GetEdges(histogram->GetXaxis());
+    zenithEdges = histogram->GetDimension() == 2 ? GetEdges(histogram->GetYaxis()) : vector<double>{0, 0};
+    if (energyEdges.front() < 0 || zenithEdges.front() < 0 || zenithEdges.back() > 180) {
+        throw runtime_error("Input spectrum must have positive energies and zenith angles between 0 and 180 degrees");
+    }
+
+    // under / overflow bins are ignored
+    const auto energyBins = (int) energyEdges.size() - 1;
+    const auto zenithBins = (int) zenithEdges.size() - 1;
+    vector<double> weights;
+    weights.reserve(energyBins * zenithBins);
+    for (int zenithBin = 1; zenithBin <= zenithBins; ++zenithBin) {
+        for (int energyBin = 1; energyBin <= energyBins; ++energyBin) {
+            weights.push_back(histogram->GetBinContent(histogram->GetBin(energyBin, zenithBin)));
+        }
+    }
+    table = AliasTable(weights);
+
+    G4cout << "Input spectrum " << histogram->GetName() << " from " << filename << ": " << energyBins
+           << " energy bins from " << energyEdges.front() << " to " << energyEdges.back() << " MeV";
+    if (histogram->GetDimension() == 2) {
+        G4cout << ", " << zenithBins << " zenith bins from " << zenithEdges.front() << " to " << zenithEdges.back()
+               << " degrees";
+    }
+    G4cout << G4endl;
+}
+
+void Spectrum::Sample(double u1, double u2, double u3, double u4, double &energy, G4ThreeVector &direction) {
+    const auto energyBins = (int) energyEdges.size() - 1;
+    const auto bin = table.Sample(u1);
+    const auto energyBin = bin % energyBins;
+    const auto zenithBin = bin / energyBins;
+
+    energy = (energyEdges[energyBin] + u2 * (energyEdges[energyBin + 1] - energyEdges[energyBin])) * MeV;
+
+    const auto zenith = (zenithEdges[zenithBin] + u3 * (zenithEdges[zenithBin + 1] - zenithEdges[zenithBin])) * deg;
+    const auto azimuth = u4 * twopi;
+    direction = {sin(zenith) * cos(azimuth), sin(zenith) * sin(azimuth), cos(zenith)};
+}
@@ -0,0 +1,31 @@
+
+#pragma once
+
+#include "AliasTable.h"
+
+#include <G4ThreeVector.hh>
+
+#include <string>
+#include <vector>
+
+// Energy / angle distribution of the primaries read from a ROOT histogram: a TH1 of the kinetic energy (MeV),
+// launched along the detector normal, or a TH2 of the kinetic energy (MeV) vs the zenith angle (degrees) with a uniform
+// azimuth. Bins are drawn from an alias table built once by the master and shared by all workers,
+// values are uniform within a bin
+class Spectrum {
+public:
+    // the first histogram in the file if no name is given
+    static void Load(const std::string& filename, const std::string& histogramName = "");
+
+    static bool IsLoaded() { return table.GetSize() > 0; }
+
+    // u1, u2, u3 and u4 uniform in [0, 1)
+    static void Sample(double u1, double u2, double u3, double u4, double& energy, G4ThreeVector& direction);
+
+private:
+    static AliasTable table;
+
+    // bin edges, only one zenith bin (at 0 degrees) for a TH1
+    static std::vector<double> energyEdges;
+    static std::vector<double> zenithEdges;
+};
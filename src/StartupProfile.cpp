@@ -0,0 +1,71 @@
+
+#include "StartupProfile.h"
+
+#include <globals.hh>
+
+#include <algorithm>
+#include <fstream>
+#include <iomanip>
+
+using namespace std;
+
+// static initialization is as close to the start of the program as we can get
+const StartupProfile::Clock::time_point StartupProfile::origin = Clock::now();
+vector<StartupProfile::Phase> StartupProfile::phases;
+mutex StartupProfile::mutex;
+string StartupProfile::outputFilename;
+
+void StartupProfile::SetOutputFilename(const string &filename) {
+    outputFilename = filename;
+}
+
+double StartupProfile::Milliseconds(Clock::time_point time) {
+    return chrono::duration<double, milli>(time - origin).count();
+}
+
+void StartupProfile::Start(const string &phase) {
+    lock_guard<std::mutex> lock(mutex);
+    const auto depth = (int) count_if(phases.begin(), phases.end(), [](const Phase &phase) { return phase.running; });
+    phases.push_back({phase, depth, Clock::now(), {}, true});
+}
+
+void StartupProfile::Stop(const string &phase) {
+    const auto now = Clock::now();
+    lock_guard<std::mutex> lock(mutex);
+    for (auto &[name, depth, start, stop, running]: phases) {
+        if (running && name == phase) {
+            stop = now;
+            running = false;
+        }
+    }
+}
+
+void StartupProfile::Report() {
+    const auto now = Clock::now();
+    lock_guard<std::mutex> lock(mutex);
+
+    G4cout << "Startup profile (ms):" << G4endl;
+    for (const auto &[name, depth, start, stop, running]: phases) {
+        const auto duration = Milliseconds(running ? now : stop) - Milliseconds(start);
+        G4cout << "  " << string(2 * depth, ' ') << setw(28 - 2 * depth) << left << name << right << fixed
+               << setprecision(1) << setw(10) << duration << "  (at " << Milliseconds(start) << ")"
+               << defaultfloat << G4endl;
+    }
+
+    if (outputFilename.empty()) {
+        return;
+    }
+    ofstream file(outputFilename);
+    if (!file) {
+        throw runtime_error("Could not open startup profile file " + outputFilename);
+    }
+    // phase names are plain identifiers, they never need escaping
+    file << fixed << setprecision(3) << "{\n  \"phases\": [";
+    for (size_t i = 0; i < phases.size(); ++i) {
+        const auto &[name, depth, start, stop, running] = phases[i];
+        file << (i == 0 ? "\n" : ",\n") << "    {\"name\": \"" << name << "\", \"depth\": " << depth
+             << ", \"start_ms\": " << Milliseconds(start) << ", \"duration_ms\": "
+             << Milliseconds(running ? now : stop) - Milliseconds(start) << "}";
+    }
+    file << "\n  ],\n  \"total_ms\": " << Milliseconds(now) << "\n}\n";
+}
@@ -0,0 +1,39 @@
+
+#pragma once
+
+#include <chrono>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// Wall clock timings of the startup phases, which may be nested, relative to the start of the program
+class StartupProfile {
+public:
+    static void Start(const std::string& phase);
+
+    // ignored unless the phase is running, so it can be called by every thread
+    static void Stop(const std::string& phase);
+
+    // prints the phases and writes them as JSON if an output file was given
+    static void Report();
+
+    static void SetOutputFilename(const std::string& filename);
+
+private:
+    using Clock = std::chrono::steady_clock;
+
+    struct Phase {
+        std::string name;
+        int depth;
+        Clock::time_point start;
+        Clock::time_point stop;
+        bool running;
+    };
+
+    static double Milliseconds(Clock::time_point time);
+
+    static const Clock::time_point origin;
+    static std::vector<Phase> phases;
+    static std::mutex mutex;
+    static std::string outputFilename;
+};
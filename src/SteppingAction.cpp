@@ -1,6 +1,7 @@
 
 #include "SteppingAction.h"
 
+#include "Culling.h"
 #include "RunAction.h"
 
 #include <G4Step.hh>
@@ -11,6 +12,11 @@ using namespace std;
 SteppingAction::SteppingAction() : G4UserSteppingAction() {}
 
 void SteppingAction::UserSteppingAction(const G4Step *step) {
+    if (Culling::IsUpstreamCullingEnabled() && Culling::HasLeftUpstream(step)) {
+        step->GetTrack()->SetTrackStatus(fStopAndKill);
+        RunAction::IncreaseCulled(Culling::Upstream);
+    }
+
     return;
     // print step info
     G4StepPoint *preStepPoint = step->GetPreStepPoint();
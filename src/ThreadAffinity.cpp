@@ -0,0 +1,141 @@
+
+#include "ThreadAffinity.h"
+
+#include <G4Threading.hh>
+#include <G4ios.hh>
+
+#include <pthread.h>
+#include <sched.h>
+
+#include <algorithm>
+#include <cctype>
+#include <filesystem>
+#include <fstream>
+#include <map>
+#include <stdexcept>
+#include <tuple>
+
+using namespace std;
+
+ThreadAffinity::Policy ThreadAffinity::policy = ThreadAffinity::None;
+vector<ThreadAffinity::Cpu> ThreadAffinity::order;
+
+namespace {
+const filesystem::path cpuDirectory = "/sys/devices/system/cpu";
+
+int ReadTopologyValue(int cpu, const string &name) {
+    ifstream file(cpuDirectory / ("cpu" + to_string(cpu)) / "topology" / name);
+    int value = 0;
+    if (!(file >> value)) {
+        // not exposed (e.g. in some containers), the CPU is then its own core on a single socket
+        return name == "core_id" ? cpu : 0;
+    }
+    return value;
+}
+
+int ReadNode(int cpu) {
+    error_code error;
+    for (const auto &entry: filesystem::directory_iterator(cpuDirectory / ("cpu" + to_string(cpu)), error)) {
+        const auto name = entry.path().filename().string();
+        if (name.size() > 4 && name.starts_with("node") &&
+            all_of(name.begin() + 4, name.end(), [](char c) { return isdigit(c); })) {
+            return stoi(name.substr(4));
+        }
+    }
+    return 0;
+}
+}// namespace
+
+void ThreadAffinity::SetPolicy(const string &name) {
+    const auto names = GetPolicyNames();
+    const auto it = find(names.begin(), names.end(), name);
+    if (it == names.end()) {
+        throw runtime_error("Unknown thread affinity policy: " + name);
+    }
+    policy = (Policy) (it - names.begin());
+}
+
+vector<ThreadAffinity::Cpu> ThreadAffinity::ReadTopology() {
+    // only the CPUs this process may run on (taskset, cgroups, the batch system...)
+    cpu_set_t allowed;
+    CPU_ZERO(&allowed);
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) != 0) {
+        throw runtime_error("Could not read the CPU affinity of the process");
+    }
+
+    vector<Cpu> cpus;
+    for (int id = 0; id < CPU_SETSIZE; ++id) {
+        if (CPU_ISSET(id, &allowed)) {
+            cpus.push_back({id, ReadTopologyValue(id, "physical_package_id"), ReadTopologyValue(id, "core_id"),
+                            ReadNode(id), 0});
+        }
+    }
+
+    // the CPUs are in increasing id, so the first one seen of each core is its first hardware thread
+    map<pair<int, int>, int> threadsPerCore;
+    for (auto &cpu: cpus) {
+        cpu.sibling = threadsPerCore[{cpu.package, cpu.core}]++;
+    }
+    return cpus;
+}
+
+void ThreadAffinity::Initialize(int nThreads) {
+    if (!IsEnabled()) {
+        return;
+    }
+
+    order = ReadTopology();
+    if (policy == Compact) {
+        sort(order.begin(), order.end(), [](const Cpu &a, const Cpu &b) {
+            return tie(a.sibling, a.package, a.core, a.id) < tie(b.sibling, b.package, b.core, b.id);
+        });
+    } else {
+        // rank of each CPU among the ones of its socket with the same sibling index, so sockets take turns
+        map<pair<int, int>, vector<Cpu *>> groups;
+        for (auto &cpu: order) {
+            groups[{cpu.package, cpu.sibling}].push_back(&cpu);
+        }
+        map<int, int> rank;
+        for (auto &[key, group]: groups) {
+            sort(group.begin(), group.end(), [](const Cpu *a, const Cpu *b) {
+                return tie(a->core, a->id) < tie(b->core, b->id);
+            });
+            for (int i = 0; i < (int) group.size(); ++i) {
+                rank[group[i]->id] = i;
+            }
+        }
+        sort(order.begin(), order.end(), [&rank](const Cpu &a, const Cpu &b) {
+            return tie(a.sibling, rank[a.id], a.package, a.id) < tie(b.sibling, rank[b.id], b.package, b.id);
+        });
+    }
+
+    const auto physicalCores = count_if(order.begin(), order.end(), [](const Cpu &cpu) { return cpu.sibling == 0; });
+    G4cout << "Thread affinity (" << GetPolicyNames()[policy] << "): " << order.size() << " CPUs available, "
+           << physicalCores << " physical cores" << G4endl;
+    if (nThreads > physicalCores) {
+        G4cout << "Warning: " << nThreads << " threads for " << physicalCores
+               << " physical cores, some workers share a core with an SMT sibling" << G4endl;
+    }
+    for (int i = 0; i < nThreads; ++i) {
+        const auto &cpu = order[i % order.size()];
+        G4cout << "    worker " << i << " -> CPU " << cpu.id << " (socket " << cpu.package << ", core " << cpu.core
+               << ", NUMA node " << cpu.node << (cpu.sibling > 0 ? ", SMT sibling" : "") << ")" << G4endl;
+    }
+}
+
+void ThreadAffinity::PinWorker(int threadId) {
+    if (!IsEnabled() || order.empty() || threadId < 0) {
+        return;
+    }
+    const auto &cpu = order[threadId % order.size()];
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu.id, &set);
+    if (pthread_setaffinity_np(pthread_self(), sizeof(set), &set) != 0) {
+        G4cout << "Warning: could not pin worker " << threadId << " to CPU " << cpu.id << G4endl;
+    }
+}
+
+void WorkerInitialization::WorkerStart() const {
+    ThreadAffinity::PinWorker(G4Threading::G4GetThreadId());
+}
@@ -0,0 +1,49 @@
+
+#pragma once
+
+#include <G4UserWorkerInitialization.hh>
+
+#include <string>
+#include <vector>
+
+// Pins the worker threads to logical CPUs, read from the topology in /sys among the ones this process may use.
+// Physical cores are used before their SMT siblings. "compact" fills a socket before the next one, "scatter"
+// places consecutive workers on alternating sockets
+class ThreadAffinity {
+public:
+    enum Policy { None, Compact, Scatter };
+
+    static std::vector<std::string> GetPolicyNames() { return {"none", "compact", "scatter"}; }
+
+    static void SetPolicy(const std::string& name);
+
+    static bool IsEnabled() { return policy != None; }
+
+    // called by the master before the workers start, builds and logs the affinity map
+    static void Initialize(int nThreads);
+
+    // called on the worker thread before it allocates anything
+    static void PinWorker(int threadId);
+
+private:
+    struct Cpu {
+        int id;
+        int package;
+        int core;
+        int node;
+        // 0 for the first hardware thread of its core, 1 for its first SMT sibling...
+        int sibling;
+    };
+
+    static std::vector<Cpu> ReadTopology();
+
+    static Policy policy;
+    // CPU of worker i is order[i % order.size()]
+    static std::vector<Cpu> order;
+};
+
+// pins each worker as soon as its thread starts, before its run and event state is allocated
+class WorkerInitialization : public G4UserWorkerInitialization {
+public:
+    void WorkerStart() const override;
+};
@@ -0,0 +1,103 @@
+
+#include "TiledHistogram2D.h"
+
+#include <cmath>
+
+using namespace std;
+
+TiledHistogram2D::TiledHistogram2D(int nx, int ny)
+    : cellsX(nx + 2), cellsY(ny + 2), tilesX((cellsX + tileSizeX - 1) / tileSizeX),
+      tilesY((cellsY + tileSizeY - 1) / tileSizeY), tiles(tilesX * tilesY) {}
+
+void TiledHistogram2D::Tile::AddCarry(int cell, uint32_t carry) {
+    if (carries == nullptr) {
+        carries = make_unique<uint32_t[]>(tileSize);
+    }
+    carries[cell] += carry;
+}
+
+void TiledHistogram2D::Tile::AllocateWeights() {
+    sumw = make_unique<double[]>(tileSize);
+    sumw2 = make_unique<double[]>(tileSize);
+}
+
+void TiledHistogram2D::Add(const TiledHistogram2D &other) {
+    for (size_t i = 0; i < tiles.size(); ++i) {
+        const auto &from = other.tiles[i];
+        if (from == nullptr) {
+            continue;
+        }
+        auto &to = tiles[i];
+        if (to == nullptr) {
+            to = make_unique<Tile>();
+        }
+        for (int cell = 0; cell < tileSize; ++cell) {
+            const uint64_t count = to->counts[cell] + (uint64_t) from->counts[cell];
+            to->counts[cell] = (uint32_t) count;
+            const auto carry = (uint32_t) (count >> 32) + (from->carries == nullptr ? 0 : from->carries[cell]);
+            if (carry > 0) {
+                to->AddCarry(cell, carry);
+            }
+        }
+        if (from->sumw != nullptr) {
+            if (to->sumw == nullptr) {
+                to->AllocateWeights();
+            }
+            for (int cell = 0; cell < tileSize; ++cell) {
+                to->sumw[cell] += from->sumw[cell];
+                to->sumw2[cell] += from->sumw2[cell];
+            }
+        }
+    }
+    weighted = weighted || other.weighted;
+}
+
+double TiledHistogram2D::GetBinContent(int binx, int biny) const {
+    const auto &tile = tiles[(binx >> tileShiftX) + tilesX * (biny >> tileShiftY)];
+    if (tile == nullptr) {
+        return 0;
+    }
+    const auto cell = (binx & (tileSizeX - 1)) + tileSizeX * (biny & (tileSizeY - 1));
+    return (double) tile->GetCount(cell) + (tile->sumw == nullptr ? 0 : tile->sumw[cell]);
+}
+
+void TiledHistogram2D::CopyTo(TH2D *histogram) const {
+    if (weighted) {
+        histogram->Sumw2();
+    }
+    for (int tileY = 0; tileY < tilesY; ++tileY) {
+        for (int tileX = 0; tileX < tilesX; ++tileX) {
+            const auto &tile = tiles[tileX + tilesX * tileY];
+            if (tile == nullptr) {
+                continue;
+            }
+            for (int cell = 0; cell < tileSize; ++cell) {
+                const auto binx = tileX * tileSizeX + cell % tileSizeX;
+                const auto biny = tileY * tileSizeY + cell / tileSizeX;
+                if (binx >= cellsX || biny >= cellsY) {
+                    continue;
+                }
+                const auto count = (double) tile->GetCount(cell);
+                const auto sumw = tile->sumw == nullptr ? 0.0 : tile->sumw[cell];
+                const auto sumw2 = tile->sumw == nullptr ? 0.0 : tile->sumw2[cell];
+                if (count == 0 && sumw2 == 0) {
+                    continue;
+                }
+                const auto bin = histogram->GetBin(binx, biny);
+                histogram->SetBinContent(bin, count + sumw);
+                if (weighted) {
+                    // unit weight fills contribute 1 each to the sum of squared weights
+                    histogram->SetBinError(bin, sqrt(count + sumw2));
+                }
+            }
+        }
+    }
+}
+
+size_t TiledHistogram2D::GetAllocatedTiles() const {
+    size_t allocated = 0;
+    for (const auto &tile: tiles) {
+        allocated += tile != nullptr;
+    }
+    return allocated;
+}
@@ -0,0 +1,91 @@
+
+#pragma once
+
+#include <TH2D.h>
+
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+// 2D histogram stored as tiles of 32-bit counts which are only allocated once a bin in them is filled.
+// Fills with a weight other than 1 go to sums of weights and squared weights allocated per tile on the first one.
+// Bins follow the ROOT convention (0 is the underflow, n + 1 the overflow) and are converted to a TH2D for writing
+class TiledHistogram2D {
+public:
+    TiledHistogram2D(int nx, int ny);
+
+    void Fill(int binx, int biny) {
+        auto& tile = tiles[(binx >> tileShiftX) + tilesX * (biny >> tileShiftY)];
+        if (tile == nullptr) {
+            tile = std::make_unique<Tile>();
+        }
+        const auto cell = (binx & (tileSizeX - 1)) + tileSizeX * (biny & (tileSizeY - 1));
+        if (++tile->counts[cell] == 0) {
+            tile->AddCarry(cell, 1);
+        }
+    }
+
+    void Fill(int binx, int biny, double weight) {
+        if (weight == 1.0) {
+            Fill(binx, biny);
+            return;
+        }
+        auto& tile = tiles[(binx >> tileShiftX) + tilesX * (biny >> tileShiftY)];
+        if (tile == nullptr) {
+            tile = std::make_unique<Tile>();
+        }
+        if (tile->sumw == nullptr) {
+            tile->AllocateWeights();
+            weighted = true;
+        }
+        const auto cell = (binx & (tileSizeX - 1)) + tileSizeX * (biny & (tileSizeY - 1));
+        tile->sumw[cell] += weight;
+        tile->sumw2[cell] += weight * weight;
+    }
+
+    void Add(const TiledHistogram2D& other);
+
+    double GetBinContent(int binx, int biny) const;
+
+    bool IsWeighted() const { return weighted; }
+
+    // sets the content (and errors if weighted) of every filled bin, the TH2D must have the same number of bins
+    void CopyTo(TH2D* histogram) const;
+
+    size_t GetAllocatedTiles() const;
+
+private:
+    static constexpr int tileShiftX = 5;
+    static constexpr int tileShiftY = 3;
+    static constexpr int tileSizeX = 1 << tileShiftX;
+    static constexpr int tileSizeY = 1 << tileShiftY;
+    static constexpr int tileSize = tileSizeX * tileSizeY;
+
+    struct Tile {
+        uint32_t counts[tileSize] = {};
+        // number of times a count wrapped around, only allocated if it ever does
+        std::unique_ptr<uint32_t[]> carries;
+
+        // weighted fills, only allocated once there is one
+        std::unique_ptr<double[]> sumw;
+        std::unique_ptr<double[]> sumw2;
+
+        void AddCarry(int cell, uint32_t carry);
+
+        void AllocateWeights();
+
+        uint64_t GetCount(int cell) const {
+            return counts[cell] + (carries == nullptr ? 0 : uint64_t(carries[cell]) << 32);
+        }
+    };
+
+    // including under / overflow bins
+    int cellsX;
+    int cellsY;
+    int tilesX;
+    int tilesY;
+
+    bool weighted = false;
+
+    std::vector<std::unique_ptr<Tile>> tiles;
+};
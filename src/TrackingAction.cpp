@@ -1,5 +1,6 @@
 
 #include "TrackingAction.h"
+#include "Culling.h"
 #include "RunAction.h"
 
 #include <G4ParticleDefinition.hh>
@@ -36,6 +37,14 @@ void TrackingAction::PreUserTrackingAction(const G4Track *track) {
         // kill
         G4Track *nonConstTrack = const_cast<G4Track *>(track);
         nonConstTrack->SetTrackStatus(fStopAndKill);
+        RunAction::IncreaseCulled(Culling::Neutrino);
+        return;
+    }
+
+    // charged tracks that stop before reaching the detector
+    if (Culling::IsRangeCullingEnabled() && Culling::IsOutOfRange(track)) {
+        const_cast<G4Track *>(track)->SetTrackStatus(fStopAndKill);
+        RunAction::IncreaseCulled(Culling::Range);
         return;
     }
 